@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+# Compare two benchmark result files written by run.sh.
+# Exits non-zero if any metric regressed by more than the threshold (percent).
+#
+#	./compare.py results/baseline.jsonl results/new.jsonl [threshold]
+
+import json
+import sys
+
+# Metric name -> True if higher is better.
+METRICS = {
+	"tx_pps":		True,
+	"rx_pps":		True,
+	"tx_gbps":		True,
+	"cpu_ns_per_pkt":	False,
+	"p50_us":		False,
+	"p99_us":		False,
+}
+
+def load(path):
+
+	runs = {}
+
+	with open(path) as f:
+		for line in f:
+			line = line.strip()
+			if not line.startswith("{"):
+				continue
+			run = json.loads(line)
+			runs[(run["mode"], run["frame_size"])] = run
+
+	return runs
+
+def main():
+
+	if len(sys.argv) < 3:
+		print("usage: compare.py <baseline.jsonl> <new.jsonl> [threshold percent]")
+		return 2
+
+	baseline = load(sys.argv[1])
+	new = load(sys.argv[2])
+	threshold = float(sys.argv[3]) if len(sys.argv) > 3 else 5.0
+	regressions = 0
+
+	for key in sorted(baseline):
+
+		if key not in new:
+			print("%-8s %5d: missing from new results" % key)
+			regressions += 1
+			continue
+
+		for metric, higher_is_better in METRICS.items():
+
+			if metric not in baseline[key] or metric not in new[key]:
+				continue
+
+			old_value = float(baseline[key][metric])
+			new_value = float(new[key][metric])
+			if old_value == 0:
+				continue
+
+			change = (new_value - old_value) / old_value * 100
+			regressed = change < -threshold if higher_is_better else change > threshold
+			regressions += regressed
+
+			print("%-8s %5d %-15s %14.2f -> %14.2f  %+7.2f%%%s" % (key[0], key[1], metric, old_value, new_value, change, "  REGRESSION" if regressed else ""))
+
+	return 1 if regressions else 0
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,387 @@
+// Native raw-ethernet traffic generator / sink used by the benchmark suite.
+//
+// Modes:
+//	ethbench tx      <ifname> <frame size> <count>	Blast frames, count what the reflector returns.
+//	ethbench ping    <ifname> <frame size> <count>	One frame in flight, measure round trip latency.
+//	ethbench reflect <ifname>			Echo every bench frame back (host side, on the tap).
+//
+// Each tx/ping run prints a single JSON line on stdout, so results can be
+// appended straight into a .jsonl file and compared with compare.py.
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// IEEE local experimental ethertype, so we never confuse our frames with real traffic.
+#define ETHBENCH_ETHER_TYPE	0x88B5
+#define ETHBENCH_MAGIC		0x69825400
+
+#define ETHBENCH_MIN_FRAME	60
+#define ETHBENCH_MAX_FRAME	1514
+#define ETHBENCH_BATCH		64
+
+// Time to wait for stragglers from the reflector after the last frame went out.
+#define ETHBENCH_DRAIN_NS	500000000ULL
+#define ETHBENCH_PING_TIMEOUT_MS 1000
+
+struct ethbench_header{
+
+	struct ether_header eth;
+
+	u_int32_t magic;
+	u_int32_t seq;
+	u_int64_t timestamp;
+
+} __attribute__((packed));
+
+static int sock;
+static int ifindex;
+static unsigned char if_mac[ETH_ALEN];
+
+static volatile int tx_done;
+static volatile u_int64_t rx_frames;
+static volatile u_int64_t tx_end_ns;
+static volatile u_int64_t rx_last_ns;
+
+static u_int64_t now_ns(void){
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u_int64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Busy/total jiffies from the aggregate cpu line of /proc/stat.
+static void cpu_jiffies(u_int64_t *busy, u_int64_t *total){
+
+	unsigned long long v[8] = {0};
+	FILE *f = fopen("/proc/stat", "r");
+
+	*busy = *total = 0;
+	if(!f)
+		return;
+
+	if(fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu %llu", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) == 8){
+		*total = v[0] + v[1] + v[2] + v[3] + v[4] + v[5] + v[6] + v[7];
+		*busy  = *total - v[3] - v[4];
+	}
+
+	fclose(f);
+}
+
+static int open_socket(const char *ifname){
+
+	struct sockaddr_ll addr;
+	struct ifreq ifr;
+	int buffer_size = 4 * 1024 * 1024;
+
+	sock = socket(AF_PACKET, SOCK_RAW, htons(ETHBENCH_ETHER_TYPE));
+	if(sock < 0){
+		perror("socket");
+		return -1;
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+	if(ioctl(sock, SIOCGIFINDEX, &ifr) < 0){
+		perror("SIOCGIFINDEX");
+		return -1;
+	}
+	ifindex = ifr.ifr_ifindex;
+
+	if(ioctl(sock, SIOCGIFHWADDR, &ifr) < 0){
+		perror("SIOCGIFHWADDR");
+		return -1;
+	}
+	memcpy(if_mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sll_family   = AF_PACKET;
+	addr.sll_protocol = htons(ETHBENCH_ETHER_TYPE);
+	addr.sll_ifindex  = ifindex;
+	if(bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0){
+		perror("bind");
+		return -1;
+	}
+
+	// Big socket buffers so the measurement isn't limited by our own drops.
+	setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+
+	return 0;
+}
+
+static void build_frame(unsigned char *frame, unsigned int size, u_int32_t seq){
+
+	struct ethbench_header *header = (struct ethbench_header*)frame;
+	unsigned int i;
+
+	memset(header->eth.ether_dhost, 0xFF, ETH_ALEN);
+	memcpy(header->eth.ether_shost, if_mac, ETH_ALEN);
+	header->eth.ether_type = htons(ETHBENCH_ETHER_TYPE);
+	header->magic = htonl(ETHBENCH_MAGIC);
+	header->seq = htonl(seq);
+	header->timestamp = now_ns();
+
+	for(i = sizeof(*header); i < size; i++)
+		frame[i] = (unsigned char)(seq + i);
+}
+
+static int is_bench_frame(const unsigned char *frame, ssize_t len){
+
+	const struct ethbench_header *header = (const struct ethbench_header*)frame;
+
+	return len >= (ssize_t)sizeof(*header) && ntohl(header->magic) == ETHBENCH_MAGIC;
+}
+
+// Receive one incoming bench frame. AF_PACKET also hands us our own
+// transmissions, those are skipped and reported as zero length.
+static ssize_t recv_bench_frame(unsigned char *frame, size_t size, int flags){
+
+	struct sockaddr_ll from;
+	socklen_t from_len = sizeof(from);
+	ssize_t len;
+
+	len = recvfrom(sock, frame, size, flags, (struct sockaddr*)&from, &from_len);
+	if(len < 0)
+		return len;
+
+	if(from.sll_pkttype == PACKET_OUTGOING || !is_bench_frame(frame, len))
+		return 0;
+
+	return len;
+}
+
+// Counts returned frames until the sender is done and the drain window has passed.
+static void *rx_thread(void *param){
+
+	unsigned char frame[ETHBENCH_MAX_FRAME + 64];
+	struct pollfd pfd = { .fd = sock, .events = POLLIN };
+	ssize_t len;
+
+	(void)param;
+
+	for(;;){
+
+		if(tx_done && now_ns() > tx_end_ns + ETHBENCH_DRAIN_NS)
+			break;
+
+		if(poll(&pfd, 1, 10) <= 0)
+			continue;
+
+		while((len = recv_bench_frame(frame, sizeof(frame), MSG_DONTWAIT)) >= 0){
+			if(len){
+				rx_frames++;
+				rx_last_ns = now_ns();
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int cmp_u64(const void *a, const void *b){
+
+	u_int64_t x = *(const u_int64_t*)a;
+	u_int64_t y = *(const u_int64_t*)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int run_tx(const char *ifname, unsigned int size, unsigned int count){
+
+	static unsigned char frames[ETHBENCH_BATCH][ETHBENCH_MAX_FRAME];
+	struct mmsghdr messages[ETHBENCH_BATCH];
+	struct iovec iovecs[ETHBENCH_BATCH];
+	pthread_t rx;
+	u_int64_t start, elapsed, busy0, total0, busy1, total1;
+	unsigned int sent = 0, i;
+	int error;
+
+	memset(messages, 0, sizeof(messages));
+	for(i = 0; i < ETHBENCH_BATCH; i++){
+		iovecs[i].iov_base = frames[i];
+		iovecs[i].iov_len = size;
+		messages[i].msg_hdr.msg_iov = &iovecs[i];
+		messages[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	pthread_create(&rx, 0, rx_thread, 0);
+
+	cpu_jiffies(&busy0, &total0);
+	start = now_ns();
+
+	while(sent < count){
+
+		unsigned int batch = count - sent < ETHBENCH_BATCH ? count - sent : ETHBENCH_BATCH;
+
+		for(i = 0; i < batch; i++)
+			build_frame(frames[i], size, sent + i);
+
+		error = sendmmsg(sock, messages, batch, 0);
+		if(error < 0){
+			// The driver returns NETDEV_TX_BUSY when the ring is full. Back off and retry.
+			if(errno == ENOBUFS || errno == EAGAIN){
+				sched_yield();
+				continue;
+			}
+			perror("sendmmsg");
+			return 1;
+		}
+
+		sent += error;
+	}
+
+	tx_end_ns = now_ns();
+	tx_done = 1;
+	pthread_join(rx, 0);
+
+	// The CPU samples span the TX phase and the drain window, so the work of
+	// returning the last frames is included. Busy time is summed over all CPUs.
+	cpu_jiffies(&busy1, &total1);
+	elapsed = tx_end_ns - start;
+
+	printf("{\"mode\":\"tx\",\"ifname\":\"%s\",\"frame_size\":%u,\"count\":%u,"
+	       "\"tx_pps\":%.0f,\"tx_gbps\":%.4f,\"rx_frames\":%llu,\"rx_pps\":%.0f,"
+	       "\"cpu_ns_per_pkt\":%.1f,\"cpu_util\":%.3f}\n",
+	       ifname, size, count,
+	       count * 1e9 / elapsed,
+	       (double)count * size * 8 / elapsed,
+	       (unsigned long long)rx_frames,
+	       rx_last_ns > start ? rx_frames * 1e9 / (rx_last_ns - start) : 0.0,
+	       (double)(busy1 - busy0) * 1e9 / sysconf(_SC_CLK_TCK) / count,
+	       total1 > total0 ? (double)(busy1 - busy0) / (total1 - total0) : 0.0);
+
+	return 0;
+}
+
+static int run_ping(const char *ifname, unsigned int size, unsigned int count){
+
+	unsigned char frame[ETHBENCH_MAX_FRAME], reply[ETHBENCH_MAX_FRAME + 64];
+	struct pollfd pfd = { .fd = sock, .events = POLLIN };
+	u_int64_t *rtts = calloc(count, sizeof(*rtts));
+	unsigned int i, received = 0, lost = 0;
+	ssize_t len;
+
+	if(!rtts)
+		return 1;
+
+	for(i = 0; i < count; i++){
+
+		u_int64_t sent_at;
+
+		build_frame(frame, size, i);
+		sent_at = now_ns();
+		if(send(sock, frame, size, 0) < 0){
+			perror("send");
+			return 1;
+		}
+
+		for(;;){
+
+			if(poll(&pfd, 1, ETHBENCH_PING_TIMEOUT_MS) <= 0){
+				lost++;
+				break;
+			}
+
+			len = recv_bench_frame(reply, sizeof(reply), 0);
+			if(len <= 0 || ntohl(((struct ethbench_header*)reply)->seq) != i)
+				continue;
+
+			rtts[received++] = now_ns() - sent_at;
+			break;
+		}
+	}
+
+	qsort(rtts, received, sizeof(*rtts), cmp_u64);
+
+	printf("{\"mode\":\"ping\",\"ifname\":\"%s\",\"frame_size\":%u,\"count\":%u,\"lost\":%u,"
+	       "\"p50_us\":%.2f,\"p99_us\":%.2f,\"max_us\":%.2f}\n",
+	       ifname, size, count, lost,
+	       received ? rtts[received / 2] / 1e3 : 0.0,
+	       received ? rtts[(received * 99) / 100] / 1e3 : 0.0,
+	       received ? rtts[received - 1] / 1e3 : 0.0);
+
+	free(rtts);
+	return 0;
+}
+
+static int run_reflect(void){
+
+	unsigned char frame[ETHBENCH_MAX_FRAME + 64];
+	ssize_t len;
+
+	for(;;){
+
+		struct ether_header *eth = (struct ether_header*)frame;
+
+		len = recv_bench_frame(frame, sizeof(frame), 0);
+		if(len < 0){
+			if(errno == EINTR)
+				continue;
+			perror("recvfrom");
+			return 1;
+		}
+		if(!len)
+			continue;
+
+		memcpy(eth->ether_dhost, eth->ether_shost, ETH_ALEN);
+		memcpy(eth->ether_shost, if_mac, ETH_ALEN);
+		send(sock, frame, len, 0);
+	}
+}
+
+static void usage(void){
+
+	fprintf(stderr, "usage: ethbench tx|ping <ifname> <frame size> <count>\n");
+	fprintf(stderr, "       ethbench reflect <ifname>\n");
+}
+
+int main(int argc, char **argv){
+
+	unsigned int size, count;
+
+	if(argc < 3){
+		usage();
+		return 1;
+	}
+
+	if(open_socket(argv[2]))
+		return 1;
+
+	if(!strcmp(argv[1], "reflect"))
+		return run_reflect();
+
+	if(argc < 5){
+		usage();
+		return 1;
+	}
+
+	size  = strtoul(argv[3], 0, 0);
+	count = strtoul(argv[4], 0, 0);
+	if(size < ETHBENCH_MIN_FRAME || size > ETHBENCH_MAX_FRAME || !count){
+		fprintf(stderr, "ethbench: frame size must be %d..%d and count non-zero.\n", ETHBENCH_MIN_FRAME, ETHBENCH_MAX_FRAME);
+		return 1;
+	}
+
+	if(!strcmp(argv[1], "tx"))
+		return run_tx(argv[2], size, count);
+	if(!strcmp(argv[1], "ping"))
+		return run_ping(argv[2], size, count);
+
+	usage();
+	return 1;
+}
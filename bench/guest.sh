@@ -0,0 +1,66 @@
+#!/bin/sh
+# Runs inside the QEMU guest as rdinit. Loads the driver, runs the frame-size
+# matrix with pktgen and ethbench, and writes one JSON line per run to the
+# second serial port (ttyS1), which run.sh maps to the results file on the host.
+# The console (ttyS0) is left to uart_print().
+
+export PATH=/bin:/sbin:/usr/bin:/usr/sbin
+
+mount -t proc proc /proc
+mount -t sysfs sysfs /sys
+mount -t debugfs debugfs /sys/kernel/debug 2>/dev/null
+
+# Parameters passed on the kernel command line by run.sh.
+for arg in $(cat /proc/cmdline); do
+	case "$arg" in
+		bench.sizes=*)	SIZES=$(echo "${arg#*=}" | tr ',' ' ') ;;
+		bench.count=*)	COUNT=${arg#*=} ;;
+		bench.pings=*)	PINGS=${arg#*=} ;;
+		bench.tag=*)	TAG=${arg#*=} ;;
+	esac
+done
+
+SIZES=${SIZES:-60 124 252 508 1020 1514}
+COUNT=${COUNT:-200000}
+PINGS=${PINGS:-10000}
+RESULTS=/dev/ttyS1
+
+result(){
+	# Prefix every record with the build tag so result files can be concatenated.
+	echo "$1" | sed "s/^{/{\"tag\":\"$TAG\",/" > $RESULTS
+}
+
+insmod /bench/i82540EM.ko || { echo "guest.sh: insmod failed"; poweroff -f; }
+
+# The driver has no ndo_open, pick whatever interface it registered.
+IFNAME=$(ls /sys/class/net | grep -v lo | head -n 1)
+ip link set "$IFNAME" up
+sleep 1
+
+for size in $SIZES; do
+
+	/bench/ethbench tx   "$IFNAME" "$size" "$COUNT" | while read -r line; do result "$line"; done
+	/bench/ethbench ping "$IFNAME" "$size" "$PINGS" | while read -r line; do result "$line"; done
+
+	# pktgen measures the bare ndo_start_xmit path without any socket overhead.
+	# pkt_size is the frame length without the 4 byte FCS, same as ethbench's frame size.
+	if [ -d /proc/net/pktgen ]; then
+		echo "rem_device_all"			> /proc/net/pktgen/kpktgend_0
+		echo "add_device $IFNAME"		> /proc/net/pktgen/kpktgend_0
+		echo "count $COUNT"			> /proc/net/pktgen/$IFNAME
+		echo "pkt_size $size"			> /proc/net/pktgen/$IFNAME
+		echo "delay 0"				> /proc/net/pktgen/$IFNAME
+		echo "dst_mac ff:ff:ff:ff:ff:ff"	> /proc/net/pktgen/$IFNAME
+		echo "start"				> /proc/net/pktgen/pgctrl
+
+		# Result line looks like: "OK: 1234(c1200+d34) usec, 200000 (64byte,0frags)"
+		#                         "  162074pps 82Mb/sec (82981888bps) errors: 0"
+		pps=$(grep -o '[0-9]*pps' /proc/net/pktgen/$IFNAME | tr -d 'ps')
+		bps=$(grep -o '([0-9]*bps)' /proc/net/pktgen/$IFNAME | tr -d '(bps)')
+		errors=$(grep -o 'errors: [0-9]*' /proc/net/pktgen/$IFNAME | tr -dc '0-9')
+		result "{\"mode\":\"pktgen\",\"ifname\":\"$IFNAME\",\"frame_size\":$size,\"count\":$COUNT,\"tx_pps\":${pps:-0},\"tx_gbps\":$(awk "BEGIN{print ${bps:-0}/1e9}"),\"errors\":${errors:-0}}"
+	fi
+done
+
+rmmod i82540EM
+poweroff -f
@@ -0,0 +1,89 @@
+#!/bin/sh
+# Reproducible throughput/latency benchmark for the driver.
+#
+# Boots KERNEL in QEMU with the emulated e1000 (82540EM) on a tap device,
+# runs bench/guest.sh as init, and reflects every bench frame straight back
+# from the host side of the tap so both tx_data() and rx_data() are exercised.
+#
+# Needs root (tap + AF_PACKET), qemu-system-x86_64 with KVM, and:
+#	KERNEL	bzImage from ../linux-5.4 built with CONFIG_NET_PKTGEN, without CONFIG_E1000.
+#	ROOTFS	A busybox initramfs (cpio, optionally gzipped). Our files are appended to it.
+#
+# Optional:
+#	SIZES	Comma separated frame sizes, excluding FCS.	(60,124,252,508,1020,1514)
+#	COUNT	Frames per throughput run.			(200000)
+#	PINGS	Round trips per latency run.			(10000)
+#	TAG	Label stored with every result.			(git describe)
+#	SMP	Guest CPUs.					(2)
+#
+# Results go to bench/results/<tag>.jsonl, one JSON object per run.
+# Compare two runs with: ./compare.py results/old.jsonl results/new.jsonl
+
+set -e
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+REPO_DIR=$(dirname "$BENCH_DIR")
+
+KERNEL=${KERNEL:-$REPO_DIR/../linux-5.4/arch/x86/boot/bzImage}
+ROOTFS=${ROOTFS:?set ROOTFS to a busybox initramfs}
+SIZES=${SIZES:-60,124,252,508,1020,1514}
+COUNT=${COUNT:-200000}
+PINGS=${PINGS:-10000}
+TAG=${TAG:-$(git -C "$REPO_DIR" describe --always --dirty 2>/dev/null || echo unknown)}
+SMP=${SMP:-2}
+TAP=${TAP:-i82540em-bench0}
+
+WORK=$(mktemp -d)
+RESULTS_DIR=$BENCH_DIR/results
+RESULTS=$RESULTS_DIR/$TAG.jsonl
+
+cleanup(){
+	[ -n "$REFLECTOR" ] && kill "$REFLECTOR" 2>/dev/null
+	ip link del "$TAP" 2>/dev/null
+	rm -rf "$WORK"
+}
+trap cleanup EXIT INT TERM
+
+# Build the module and the static traffic generator.
+(cd "$REPO_DIR" && sh build.sh)
+${CC:-gcc} -O2 -static -o "$WORK/ethbench" "$BENCH_DIR/ethbench.c" -lpthread
+
+# Append our files to the base initramfs. The kernel unpacks concatenated cpio archives in order.
+mkdir -p "$WORK/root/bench"
+cp "$REPO_DIR/i82540EM.ko" "$WORK/ethbench" "$WORK/root/bench/"
+cp "$BENCH_DIR/guest.sh" "$WORK/root/bench/"
+chmod +x "$WORK/root/bench/guest.sh"
+cp "$ROOTFS" "$WORK/initramfs"
+(cd "$WORK/root" && find . | cpio -o -H newc 2>/dev/null) >> "$WORK/initramfs"
+
+# Host side of the link. Reflect everything the guest sends.
+ip tuntap add dev "$TAP" mode tap
+ip link set "$TAP" up
+"$WORK/ethbench" reflect "$TAP" &
+REFLECTOR=$!
+
+mkdir -p "$RESULTS_DIR"
+: > "$WORK/results"
+
+qemu-system-x86_64 \
+	-enable-kvm -cpu host -smp "$SMP" -m 1G \
+	-nographic -no-reboot \
+	-kernel "$KERNEL" \
+	-initrd "$WORK/initramfs" \
+	-append "console=ttyS0 rdinit=/bench/guest.sh panic=-1 bench.sizes=$SIZES bench.count=$COUNT bench.pings=$PINGS bench.tag=$TAG" \
+	-netdev tap,id=n0,ifname="$TAP",script=no,downscript=no \
+	-device e1000,netdev=n0,mac=AA:BB:CC:DD:EE:FF \
+	-chardev file,id=results,path="$WORK/results" \
+	-device isa-serial,chardev=results \
+	> "$WORK/console.log"
+
+tr -d '\r' < "$WORK/results" > "$RESULTS"
+
+if [ ! -s "$RESULTS" ]; then
+	echo "run.sh: no results, guest console follows." >&2
+	cat "$WORK/console.log" >&2
+	exit 1
+fi
+
+cat "$RESULTS"
+echo "run.sh: results written to $RESULTS"
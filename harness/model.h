@@ -0,0 +1,115 @@
+#ifndef i82540EM_MODEL_H
+#define i82540EM_MODEL_H
+
+// Userspace model of the 82540EM as seen through BAR 0 and descriptor DMA.
+//
+// Registers behave like the hardware where the driver depends on it:
+//	CTRL.RST clears the register file and resets the PHY, and self-clears.
+//	MDIC reaches the PHY registers at address 1, completing immediately.
+//	ICR is clear-on-read, IMS/IMC set and clear the mask.
+//	Writing TDT makes the device consume descriptors from TDH up to TDT.
+//	Frames injected with model_rx_frame() are written at RDH, split into
+//	BSIZE sized buffers, and written back with DD and EOP on the last one.
+//	With the PHY in loopback (BMCR bit 14) transmitted frames are received
+//	instead, with a 4 byte FCS unless RCTL.SECRC is set. Like QEMU's e1000,
+//	RCTL.LBM is ignored and those frames go to the wire.
+//
+// Everything is synchronous. Interrupts only fire when a test calls model_irq().
+
+#include "shim.h"
+
+#define MODEL_BAR_SIZE		0x20000
+#define MODEL_MAX_FRAME		16384
+#define MODEL_TX_CAPTURE	1024
+
+// RCTL.LBM = 01, MAC loopback. The driver doesn't use it, the model ignores it like QEMU.
+#define MODEL_RCTL_LBM_MAC	0x40
+
+struct model_frame{
+	unsigned int length;
+	unsigned char data[MODEL_MAX_FRAME];
+};
+
+struct model{
+
+	// BAR 0 register file, indexed by offset / 4.
+	u32 regs[MODEL_BAR_SIZE / 4];
+
+	// PHY registers behind MDIC. While mdic_error is set, MDIC transactions fail.
+	u16 phy_regs[32];
+	int mdic_error;
+
+	// Widest DMA mask the platform accepts, 0 for any.
+	u64 dma_mask_limit;
+
+	// While set, TDT writes are latched but no descriptors are consumed.
+	int tx_stalled;
+
+	// While set, TDT writes are latched and the next TDH read with descriptors
+	// pending consumes them, like a device catching up in the background.
+	// Clears after that read.
+	int tx_deferred;
+
+	// Looped back frames so far, and the one (counting from 1) lost on the way.
+	unsigned int loopback_frames;
+	unsigned int loopback_drop;
+
+	// Called for every looped back frame, after it was received.
+	void (*loopback_hook)(unsigned int frame);
+
+	// Frames the device put on the wire, oldest first.
+	struct model_frame tx_frames[MODEL_TX_CAPTURE];
+	unsigned int tx_frame_count;
+
+	// Frames that arrived with no free RX descriptor.
+	unsigned int rx_missed;
+
+	// Looped back frames dropped for lack of an FCS.
+	unsigned int rx_crc_errors;
+
+	// TDH reads, each an uncached MMIO read (a VM exit under QEMU).
+	unsigned int tdh_reads;
+
+	// Descriptors touched by the device, for cycles-per-descriptor figures.
+	unsigned long long rx_descriptors_written;
+	unsigned long long tx_descriptors_consumed;
+
+	// Skbs handed to netif_rx(), oldest first.
+	struct sk_buff *rx_queue_head;
+	struct sk_buff *rx_queue_tail;
+	unsigned int rx_queue_length;
+
+	// netif_rx() calls made with bottom halves enabled.
+	unsigned int netif_rx_bh_enabled;
+
+	// Registered interrupt handler.
+	irq_handler_t irq_handler;
+	void *irq_dev_id;
+	const struct cpumask *irq_affinity_hint;
+
+	// Last scheduled tasklet.
+	struct tasklet_struct *tasklet;
+};
+
+extern struct model model;
+
+// Reset all model state. Call before probing a fresh device.
+void model_reset(void);
+
+// Register access without side effects.
+u32  model_reg(u32 offset);
+void model_set_reg(u32 offset, u32 value);
+
+// Deliver a frame from the wire. Returns 0 on success, -1 if it was dropped.
+int model_rx_frame(const void *data, unsigned int length);
+
+// Process TX descriptors up to TDT. Used after un-stalling the transmitter.
+void model_tx_kick(void);
+
+// Raise the interrupt if a cause is pending and unmasked, then run scheduled tasklets.
+void model_irq(void);
+
+// Pop the oldest skb passed up to the stack, or 0 if none.
+struct sk_buff *model_rx_pop(void);
+
+#endif // !(i82540EM_MODEL_H)
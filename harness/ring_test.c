@@ -0,0 +1,813 @@
+// Deterministic tests of the RX/TX ring handling in main.c against the device model.
+// The driver source is included directly so its static functions are reachable.
+
+#include "../main.c"
+#include "model.h"
+
+static int failures;
+
+#define CHECK(condition) do{									\
+	if(!(condition)){									\
+		fprintf(stderr, "%s:%d: %s: CHECK(%s) failed\n", __FILE__, __LINE__, __func__, #condition); \
+		failures++;									\
+		return;										\
+	}											\
+} while(0)
+
+static struct pci_dev test_pci_dev;
+
+static struct i82540EM *test_probe(void){
+
+	model_reset();
+	memset(&test_pci_dev, 0, sizeof(test_pci_dev));
+
+	if(i82540EM_probe(&test_pci_dev, 0))
+		return 0;
+
+	return netdev_priv(pci_get_drvdata(&test_pci_dev));
+}
+
+static void test_remove(void){
+
+	struct sk_buff *skb;
+
+	i82540EM_remove(&test_pci_dev);
+
+	while((skb = model_rx_pop()))
+		kfree_skb(skb);
+}
+
+// Ethernet frame with the sequence number repeated across the payload.
+static unsigned int make_frame(unsigned char *frame, unsigned int length, unsigned int seq){
+
+	unsigned int i;
+
+	memcpy(frame, ETHERNET_ADDRESS, 6);
+	memset(frame + 6, 0x52, 6);
+	frame[12] = 0x88;
+	frame[13] = 0xB5;
+	for(i = 14; i < length; i++)
+		frame[i] = (unsigned char)(seq + i);
+
+	return length;
+}
+
+static int check_rx_skb(struct sk_buff *skb, unsigned int length, unsigned int seq){
+
+	unsigned char frame[MODEL_MAX_FRAME], received[MODEL_MAX_FRAME];
+
+	make_frame(frame, length, seq);
+
+	// eth_type_trans() already pulled the header. The rest may be split across fragments.
+	return skb && skb->len == length - 14 && !skb_copy_bits(skb, 0, received, skb->len) && !memcmp(received, frame + 14, length - 14);
+}
+
+static struct sk_buff *make_tx_skb(unsigned int length, unsigned int seq){
+
+	struct sk_buff *skb = dev_alloc_skb(length);
+
+	make_frame(skb_put(skb, length), length, seq);
+	return skb;
+}
+
+static int check_tx_frame(unsigned int index, unsigned int length, unsigned int seq){
+
+	unsigned char frame[MODEL_MAX_FRAME];
+
+	make_frame(frame, length, seq);
+	return index < model.tx_frame_count && model.tx_frames[index].length == length && !memcmp(model.tx_frames[index].data, frame, length);
+}
+
+static void test_probe_programs_rings(void){
+
+	struct i82540EM *i82540EM_dev = test_probe();
+
+	CHECK(i82540EM_dev);
+	CHECK(model_reg(i82540EM_RDLEN) == i82540EM_SETTING_RX_BUFFER_COUNT * i82540EM_RX_DESCRIPTOR_SIZE);
+	CHECK(model_reg(i82540EM_TDLEN) == i82540EM_SETTING_TX_BUFFER_COUNT * i82540EM_TX_DESCRIPTOR_SIZE);
+	CHECK(model_reg(i82540EM_RDT) == i82540EM_SETTING_RX_BUFFER_COUNT - 1);
+	CHECK(model_reg(i82540EM_RCTL) & i82540EM_RCTL_BITMASK_EN);
+	CHECK(model_reg(i82540EM_TCTL) & i82540EM_TCTL_BITMASK_EN);
+	CHECK(test_pci_dev.dev.dma_mask == DMA_BIT_MASK(64));
+
+	test_remove();
+}
+
+static void test_probe_dma_mask(void){
+
+	// A platform limited to 32-bit DMA still probes.
+	model_reset();
+	memset(&test_pci_dev, 0, sizeof(test_pci_dev));
+	model.dma_mask_limit = DMA_BIT_MASK(32);
+	CHECK(!i82540EM_probe(&test_pci_dev, 0));
+	CHECK(test_pci_dev.dev.dma_mask == DMA_BIT_MASK(32));
+	test_remove();
+
+	// No usable mask fails probe before anything is allocated.
+	model_reset();
+	memset(&test_pci_dev, 0, sizeof(test_pci_dev));
+	model.dma_mask_limit = DMA_BIT_MASK(24);
+	CHECK(i82540EM_probe(&test_pci_dev, 0) == -EIO);
+	CHECK(shim_pages == 0);
+}
+
+static void test_probe_programs_thresholds(void){
+
+	unsigned int saved_wthresh = rx_wthresh, saved_pthresh = tx_pthresh, saved_rdmts = rdmts;
+	unsigned char frame[MODEL_MAX_FRAME];
+	struct sk_buff *skb;
+	unsigned int i;
+	u32 rxdctl, txdctl;
+
+	// Defaults: descriptor granularity, batched RX write-back with the delay timers on.
+	CHECK(test_probe());
+	rxdctl = model_reg(i82540EM_RXDCTL);
+	txdctl = model_reg(i82540EM_TXDCTL);
+	CHECK(rxdctl & i82540EM_DCTL_BITMASK_GRAN && txdctl & i82540EM_DCTL_BITMASK_GRAN);
+	CHECK((rxdctl & i82540EM_DCTL_BITMASK_PTHRESH) >> i82540EM_DCTL_SHIFT_PTHRESH == i82540EM_SETTING_RX_PTHRESH);
+	CHECK((rxdctl & i82540EM_DCTL_BITMASK_HTHRESH) >> i82540EM_DCTL_SHIFT_HTHRESH == i82540EM_SETTING_RX_HTHRESH);
+	CHECK((rxdctl & i82540EM_DCTL_BITMASK_WTHRESH) >> i82540EM_DCTL_SHIFT_WTHRESH == i82540EM_SETTING_RX_WTHRESH);
+	CHECK((txdctl & i82540EM_DCTL_BITMASK_PTHRESH) >> i82540EM_DCTL_SHIFT_PTHRESH == i82540EM_SETTING_TX_PTHRESH);
+	CHECK((txdctl & i82540EM_DCTL_BITMASK_WTHRESH) >> i82540EM_DCTL_SHIFT_WTHRESH == i82540EM_SETTING_TX_WTHRESH);
+	CHECK(model_reg(i82540EM_RDTR) == i82540EM_SETTING_RX_DELAY);
+	CHECK(model_reg(i82540EM_RADV) == i82540EM_SETTING_RX_DELAY);
+	CHECK((model_reg(i82540EM_RCTL) & i82540EM_RCTL_BITMASK_RDMTS) == i82540EM_SETTING_RDMTS << i82540EM_RCTL_SHIFT_RDMTS);
+	test_remove();
+
+	// Unbatched write-back leaves the timers off, out of range values fall back to defaults.
+	rx_wthresh = 1;
+	tx_pthresh = 64;
+	rdmts = 2;
+	CHECK(test_probe());
+	CHECK((model_reg(i82540EM_RXDCTL) & i82540EM_DCTL_BITMASK_WTHRESH) >> i82540EM_DCTL_SHIFT_WTHRESH == 1);
+	CHECK((model_reg(i82540EM_TXDCTL) & i82540EM_DCTL_BITMASK_PTHRESH) == i82540EM_SETTING_TX_PTHRESH);
+	CHECK(model_reg(i82540EM_RDTR) == 0 && model_reg(i82540EM_RADV) == 0);
+	CHECK((model_reg(i82540EM_RCTL) & i82540EM_RCTL_BITMASK_RDMTS) == 2 << i82540EM_RCTL_SHIFT_RDMTS);
+
+	// RXDMT0 at 1/8: a burst leaving more than 32 descriptors free must not raise it.
+	for(i = 0; i < 200; i++)
+		CHECK(!model_rx_frame(frame, make_frame(frame, 64, i)));
+	CHECK(!(model_reg(i82540EM_ICR) & i82540EM_INTERRUPT_BITMASK_RXDMT0));
+	for(; i < 230; i++)
+		CHECK(!model_rx_frame(frame, make_frame(frame, 64, i)));
+	CHECK(model_reg(i82540EM_ICR) & i82540EM_INTERRUPT_BITMASK_RXDMT0);
+	model_irq();
+	while((skb = model_rx_pop()))
+		kfree_skb(skb);
+
+	rx_wthresh = saved_wthresh;
+	tx_pthresh = saved_pthresh;
+	rdmts = saved_rdmts;
+	test_remove();
+}
+
+static void test_rx_single_frame(void){
+
+	unsigned char frame[MODEL_MAX_FRAME];
+	struct sk_buff *skb;
+
+	CHECK(test_probe());
+
+	CHECK(!model_rx_frame(frame, make_frame(frame, 64, 1)));
+	model_irq();
+
+	skb = model_rx_pop();
+	CHECK(check_rx_skb(skb, 64, 1));
+	CHECK(model_reg(i82540EM_RDT) == 0);
+	kfree_skb(skb);
+
+	test_remove();
+}
+
+static void test_rx_wraparound(void){
+
+	unsigned char frame[MODEL_MAX_FRAME];
+	unsigned int i, seq = 0, length;
+	struct sk_buff *skb;
+
+	CHECK(test_probe());
+
+	// Several laps around the ring, in batches that don't divide the ring size.
+	for(i = 0; i < 7; i++){
+
+		unsigned int batch;
+
+		for(batch = 0; batch < 100; batch++){
+			length = 60 + (seq * 13) % 1455;
+			CHECK(!model_rx_frame(frame, make_frame(frame, length, seq)));
+			seq++;
+		}
+
+		model_irq();
+	}
+
+	for(i = 0; i < seq; i++){
+		skb = model_rx_pop();
+		CHECK(check_rx_skb(skb, 60 + (i * 13) % 1455, i));
+		kfree_skb(skb);
+	}
+	CHECK(!model_rx_pop());
+	CHECK(model.rx_missed == 0);
+
+	test_remove();
+}
+
+static void test_rx_multi_descriptor(void){
+
+	unsigned char frame[MODEL_MAX_FRAME];
+	unsigned long long written;
+	struct sk_buff *skb;
+
+	CHECK(test_probe());
+
+	// Make the device split full sized frames over two 1024 byte buffers.
+	model_set_reg(i82540EM_RCTL, (model_reg(i82540EM_RCTL) & ~i82540EM_RCTL_BITMASK_BSIZE) | 0x10000);
+
+	written = model.rx_descriptors_written;
+	CHECK(!model_rx_frame(frame, make_frame(frame, 1514, 7)));
+	CHECK(model.rx_descriptors_written - written == 2);
+	model_irq();
+
+	skb = model_rx_pop();
+	CHECK(check_rx_skb(skb, 1514, 7));
+	CHECK(!model_rx_pop());
+	kfree_skb(skb);
+
+	test_remove();
+}
+
+static void test_rx_small_buffers(void){
+
+	static const unsigned int sizes[] = { 256, 512, 1024 };
+	static const u32 bsize[] = { i82540EM_RCTL_BSIZE_256, i82540EM_RCTL_BSIZE_512, i82540EM_RCTL_BSIZE_1024 };
+	unsigned int saved = rx_buffer_size, saved_copybreak = copybreak;
+	struct i82540EM *i82540EM_dev;
+	unsigned char frame[MODEL_MAX_FRAME];
+	unsigned long long written;
+	struct sk_buff *skb;
+	unsigned int i, n, seq = 0;
+
+	for(i = 0; i < ARRAY_SIZE(sizes); i++){
+
+		rx_buffer_size = sizes[i];
+		i82540EM_dev = test_probe();
+		CHECK(i82540EM_dev);
+		CHECK((model_reg(i82540EM_RCTL) & (i82540EM_RCTL_BITMASK_BSIZE | i82540EM_RCTL_BITMASK_BSEX)) == bsize[i]);
+
+		// Buffers share pages: the ring costs a fraction of the half-page layout,
+		// plus the partly carved refill page.
+		CHECK(shim_pages <= i82540EM_SETTING_RX_BUFFER_COUNT * sizes[i] / PAGE_SIZE + 1);
+
+		// Each buffer maps only its own slot, never the whole shared page.
+		CHECK(shim_dma_mapped == i82540EM_SETTING_RX_BUFFER_COUNT * sizes[i]);
+
+		// Full sized frames span several descriptors and arrive as one skb of fragments.
+		// Run more than a lap so every descriptor is replaced at least once.
+		for(n = 0; n < i82540EM_SETTING_RX_BUFFER_COUNT + 10; n++, seq++){
+			written = model.rx_descriptors_written;
+			CHECK(!model_rx_frame(frame, make_frame(frame, 1514, seq)));
+			CHECK(model.rx_descriptors_written - written == (1514 + sizes[i] - 1) / sizes[i]);
+			model_irq();
+
+			skb = model_rx_pop();
+			CHECK(check_rx_skb(skb, 1514, seq));
+			CHECK(skb_shinfo(skb)->nr_frags == (1514 + sizes[i] - 1) / sizes[i]);
+			CHECK(!model_rx_pop());
+			kfree_skb(skb);
+		}
+
+		// Small frames still go through copybreak.
+		copybreak = 128;
+		CHECK(!model_rx_frame(frame, make_frame(frame, 100, seq)));
+		model_irq();
+		skb = model_rx_pop();
+		CHECK(check_rx_skb(skb, 100, seq));
+		CHECK(skb_shinfo(skb)->nr_frags == 0);
+		kfree_skb(skb);
+		copybreak = saved_copybreak;
+
+		CHECK(shim_dma_mapped == i82540EM_SETTING_RX_BUFFER_COUNT * sizes[i]);
+		test_remove();
+		CHECK(shim_pages == 0 && shim_dma_mapped == 0);
+	}
+
+	// Unsupported sizes fall back to the default.
+	rx_buffer_size = 300;
+	CHECK(test_probe());
+	CHECK((model_reg(i82540EM_RCTL) & i82540EM_RCTL_BITMASK_BSIZE) == i82540EM_RCTL_BSIZE_2048);
+	CHECK(shim_pages == i82540EM_SETTING_RX_BUFFER_COUNT);
+	CHECK(shim_dma_mapped == i82540EM_SETTING_RX_BUFFER_COUNT * PAGE_SIZE);
+	test_remove();
+	CHECK(shim_dma_mapped == 0);
+
+	rx_buffer_size = saved;
+}
+
+static void test_rx_ring_full(void){
+
+	unsigned char frame[MODEL_MAX_FRAME];
+	unsigned int i, delivered = 0;
+	struct sk_buff *skb;
+
+	CHECK(test_probe());
+
+	// No interrupt servicing: the device runs out of descriptors.
+	for(i = 0; i < i82540EM_SETTING_RX_BUFFER_COUNT + 50; i++)
+		model_rx_frame(frame, make_frame(frame, 128, i));
+
+	CHECK(model.rx_missed == 51);
+	CHECK(model_reg(i82540EM_ICR) & i82540EM_INTERRUPT_BITMASK_RXO);
+
+	model_irq();
+	while((skb = model_rx_pop())){
+		CHECK(check_rx_skb(skb, 128, delivered));
+		delivered++;
+		kfree_skb(skb);
+	}
+	CHECK(delivered == i82540EM_SETTING_RX_BUFFER_COUNT - 1);
+
+	// The ring must be fully usable again.
+	CHECK(!model_rx_frame(frame, make_frame(frame, 128, 1000)));
+	model_irq();
+	skb = model_rx_pop();
+	CHECK(check_rx_skb(skb, 128, 1000));
+	kfree_skb(skb);
+
+	test_remove();
+}
+
+static void test_rx_copybreak(void){
+
+	struct i82540EM *i82540EM_dev = test_probe();
+	unsigned char frame[MODEL_MAX_FRAME];
+	struct i82540EM_rx_buffer *rx_buffer;
+	struct page *page;
+	struct sk_buff *skb;
+
+	CHECK(i82540EM_dev);
+	rx_buffer = &i82540EM_dev->rx_buffers[0];
+	page = rx_buffer->page;
+
+	// Below copybreak: copied into the linear area, buffer re-armed in place.
+	CHECK(!model_rx_frame(frame, make_frame(frame, copybreak - 1, 1)));
+	model_irq();
+	skb = model_rx_pop();
+	CHECK(check_rx_skb(skb, copybreak - 1, 1));
+	CHECK(skb_shinfo(skb)->nr_frags == 0);
+	CHECK(rx_buffer->page == page && rx_buffer->page_offset == 0);
+	kfree_skb(skb);
+
+	// At copybreak: headers copied, the rest passed as a fragment of the first half.
+	// The descriptor flips to the other half of the same page.
+	rx_buffer = &i82540EM_dev->rx_buffers[1];
+	page = rx_buffer->page;
+	CHECK(!model_rx_frame(frame, make_frame(frame, copybreak, 2)));
+	model_irq();
+	skb = model_rx_pop();
+	CHECK(check_rx_skb(skb, copybreak, 2));
+	CHECK(skb_shinfo(skb)->nr_frags == 1);
+	CHECK(skb_shinfo(skb)->frags[0].page == page);
+	CHECK(rx_buffer->page == page && rx_buffer->page_offset == i82540EM_SETTING_RX_BUFFER_SIZE);
+	CHECK(page_ref_count(page) == 2);
+	kfree_skb(skb);
+	CHECK(page_ref_count(page) == 1);
+
+	test_remove();
+}
+
+// Receive one 600 byte frame per descriptor for a full lap of the ring.
+// The first skb is returned, the rest are freed right away.
+static struct sk_buff *rx_lap(unsigned int *seq){
+
+	unsigned char frame[MODEL_MAX_FRAME];
+	struct sk_buff *first = 0, *skb;
+	unsigned int i;
+
+	for(i = 0; i < i82540EM_SETTING_RX_BUFFER_COUNT; i++){
+
+		if(model_rx_frame(frame, make_frame(frame, 600, *seq)))
+			return first;
+		model_irq();
+
+		skb = model_rx_pop();
+		if(!check_rx_skb(skb, 600, (*seq)++)){
+			kfree_skb(skb);
+			return first;
+		}
+
+		if(first)
+			kfree_skb(skb);
+		else
+			first = skb;
+	}
+
+	return first;
+}
+
+static void test_rx_page_flip(void){
+
+	struct i82540EM *i82540EM_dev = test_probe();
+	struct i82540EM_rx_buffer *rx_buffer;
+	struct sk_buff *held, *skb;
+	struct page *page;
+	unsigned int seq = 0;
+
+	CHECK(i82540EM_dev);
+	rx_buffer = &i82540EM_dev->rx_buffers[0];
+	page = rx_buffer->page;
+
+	// The stack releases every frame: descriptor 0 keeps flipping between the halves of one page.
+	kfree_skb(rx_lap(&seq));
+	CHECK(rx_buffer->page == page && rx_buffer->page_offset == i82540EM_SETTING_RX_BUFFER_SIZE);
+	kfree_skb(rx_lap(&seq));
+	CHECK(rx_buffer->page == page && rx_buffer->page_offset == 0);
+
+	// The stack holds on to the first frame of the lap: the half it points into isn't free
+	// when descriptor 0 comes around again, so the descriptor must get a fresh page.
+	held = rx_lap(&seq);
+	CHECK(held && skb_shinfo(held)->frags[0].page == page);
+	CHECK(page_ref_count(page) == 2);
+
+	skb = rx_lap(&seq);
+	CHECK(skb && skb_shinfo(skb)->frags[0].page == page);
+	CHECK(rx_buffer->page != page && rx_buffer->page_offset == 0);
+
+	// Both halves are owned by the stack now, the page goes away with the last skb.
+	CHECK(page_ref_count(page) == 2);
+	kfree_skb(skb);
+	CHECK(page_ref_count(page) == 1);
+	kfree_skb(held);
+
+	test_remove();
+}
+
+static void test_rx_copybreak_runtime(void){
+
+	struct i82540EM *i82540EM_dev = test_probe();
+	unsigned int saved = copybreak;
+	unsigned char frame[MODEL_MAX_FRAME];
+	struct sk_buff *skb;
+
+	CHECK(i82540EM_dev);
+
+	// Copybreak off: even minimum sized frames go up as fragments.
+	copybreak = 0;
+	CHECK(!model_rx_frame(frame, make_frame(frame, 60, 1)));
+	model_irq();
+	skb = model_rx_pop();
+	CHECK(check_rx_skb(skb, 60, 1));
+	CHECK(skb_shinfo(skb)->nr_frags == 1);
+	kfree_skb(skb);
+
+	// Copybreak above the frame size: full sized frames are copied.
+	copybreak = 2048;
+	CHECK(!model_rx_frame(frame, make_frame(frame, 1514, 2)));
+	model_irq();
+	skb = model_rx_pop();
+	CHECK(check_rx_skb(skb, 1514, 2));
+	CHECK(skb_shinfo(skb)->nr_frags == 0);
+	kfree_skb(skb);
+
+	copybreak = saved;
+	test_remove();
+}
+
+static struct i82540EM *test_probe_on_node(int node){
+
+	model_reset();
+	memset(&test_pci_dev, 0, sizeof(test_pci_dev));
+	test_pci_dev.dev.numa_node = node;
+
+	if(i82540EM_probe(&test_pci_dev, 0))
+		return 0;
+
+	return netdev_priv(pci_get_drvdata(&test_pci_dev));
+}
+
+static void test_numa_placement(void){
+
+	struct i82540EM *i82540EM_dev = test_probe_on_node(2);
+	struct i82540EM_rx_buffer *rx_buffer;
+	struct page *page;
+	unsigned int i, seq = 0;
+
+	// Receive pages and the interrupt follow the device's node.
+	CHECK(i82540EM_dev);
+	CHECK(i82540EM_dev->numa_node == 2);
+	for(i = 0; i < i82540EM_SETTING_RX_BUFFER_COUNT; i++)
+		CHECK(page_to_nid(i82540EM_dev->rx_buffers[i].page) == 2);
+	CHECK(model.irq_affinity_hint == cpumask_of_node(2));
+
+	// A page the allocator placed off-node is not flipped but replaced with a local one.
+	rx_buffer = &i82540EM_dev->rx_buffers[0];
+	page = rx_buffer->page;
+	page->nid = 0;
+	kfree_skb(rx_lap(&seq));
+	CHECK(rx_buffer->page != page && page_to_nid(rx_buffer->page) == 2);
+
+	// Local pages keep flipping.
+	page = rx_buffer->page;
+	kfree_skb(rx_lap(&seq));
+	CHECK(rx_buffer->page == page);
+
+	// The hint goes away with the interrupt.
+	test_remove();
+	CHECK(!model.irq_affinity_hint);
+
+	// No node information: no hint, buffers still flip.
+	i82540EM_dev = test_probe_on_node(NUMA_NO_NODE);
+	CHECK(i82540EM_dev);
+	CHECK(!model.irq_affinity_hint);
+	rx_buffer = &i82540EM_dev->rx_buffers[0];
+	page = rx_buffer->page;
+	kfree_skb(rx_lap(&seq));
+	CHECK(rx_buffer->page == page);
+	test_remove();
+}
+
+// Rewrites the frame size parameter halfway through a self-test run.
+static void selftest_resize_hook(unsigned int frame){
+
+	if(frame == 100)
+		selftest_frame_size = 60;
+}
+
+static void test_selftest_loopback(void){
+
+	struct i82540EM *i82540EM_dev = test_probe();
+	const struct ethtool_ops *ops;
+	struct ethtool_test eth_test = { .flags = ETH_TEST_FL_OFFLINE };
+	static const unsigned int sizes[] = { 256, 512, 1024 };
+	unsigned int saved_frames = selftest_frames, saved_size = selftest_frame_size, saved_buffer_size = rx_buffer_size;
+	unsigned char frame[MODEL_MAX_FRAME];
+	unsigned int i;
+	u32 ctrl, rctl, ims;
+	u16 phy_ctrl;
+	u64 data[4];
+	struct sk_buff *skb;
+
+	CHECK(i82540EM_dev);
+	ops = i82540EM_dev->net_dev->ethtool_ops;
+	i82540EM_dev->net_dev->running = 1;
+	ctrl = model_reg(i82540EM_CTRL);
+	rctl = model_reg(i82540EM_RCTL);
+	ims = model_reg(i82540EM_IMS);
+	phy_ctrl = model.phy_regs[i82540EM_PHY_CTRL];
+
+	CHECK(ops->get_sset_count(i82540EM_dev->net_dev, ETH_SS_TEST) == 4);
+
+	// Online: the loopback test is skipped.
+	eth_test.flags = 0;
+	ops->self_test(i82540EM_dev->net_dev, &eth_test, data);
+	CHECK(!(eth_test.flags & ETH_TEST_FL_FAILED) && data[1] == 0);
+
+	// Frames already received belong to the stack. They are drained with
+	// bottom halves off, as if from the tasklet.
+	CHECK(!model_rx_frame(frame, make_frame(frame, 200, 5)));
+	CHECK(!model_rx_frame(frame, make_frame(frame, 1514, 6)));
+	eth_test.flags = ETH_TEST_FL_OFFLINE;
+	ops->self_test(i82540EM_dev->net_dev, &eth_test, data);
+	CHECK(!(eth_test.flags & ETH_TEST_FL_FAILED));
+	skb = model_rx_pop();
+	CHECK(check_rx_skb(skb, 200, 5));
+	kfree_skb(skb);
+	skb = model_rx_pop();
+	CHECK(check_rx_skb(skb, 1514, 6));
+	kfree_skb(skb);
+	CHECK(!model_rx_pop());
+	CHECK(model.netif_rx_bh_enabled == 0 && shim_bh_disabled == 0);
+
+	// Several laps of both rings, full sized frames split over fragments.
+	selftest_frames = 5 * i82540EM_SETTING_RX_BUFFER_COUNT + 3;
+	selftest_frame_size = 1514;
+	eth_test.flags = ETH_TEST_FL_OFFLINE;
+	ops->self_test(i82540EM_dev->net_dev, &eth_test, data);
+	CHECK(!(eth_test.flags & ETH_TEST_FL_FAILED));
+	CHECK(data[0] == 0 && data[1] == selftest_frames && data[2] && data[3]);
+
+	// Small frames go through the copybreak path.
+	selftest_frame_size = 60;
+	ops->self_test(i82540EM_dev->net_dev, &eth_test, data);
+	CHECK(data[0] == 0 && data[1] == selftest_frames);
+
+	// Frames carried an FCS and never reached the wire.
+	CHECK(model.rx_crc_errors == 0);
+
+	// Device state is restored, nothing leaked to the stack.
+	CHECK(model_reg(i82540EM_CTRL) == ctrl);
+	CHECK(model_reg(i82540EM_RCTL) == rctl);
+	CHECK(model_reg(i82540EM_IMS) == ims);
+	CHECK(model.phy_regs[i82540EM_PHY_CTRL] == phy_ctrl);
+	CHECK(!i82540EM_dev->net_dev->queue_stopped);
+	CHECK(!model_rx_pop() && model.tx_frame_count == 0);
+
+	// The receiver strips the FCS: frames still check out.
+	model_set_reg(i82540EM_RCTL, rctl | i82540EM_RCTL_BITMASK_SECRC);
+	ops->self_test(i82540EM_dev->net_dev, &eth_test, data);
+	CHECK(data[0] == 0 && data[1] == selftest_frames);
+	model_set_reg(i82540EM_RCTL, rctl);
+
+	// MAC loopback alone isn't honoured, like QEMU: frames leave on the wire.
+	model_set_reg(i82540EM_RCTL, rctl | MODEL_RCTL_LBM_MAC);
+	CHECK(tx_data(make_tx_skb(60, 4), i82540EM_dev->net_dev) == NETDEV_TX_OK);
+	CHECK(model.tx_frame_count == 1 && !model_rx_pop());
+	model.tx_frame_count = 0;
+	model_set_reg(i82540EM_RCTL, rctl);
+
+	// A frame the stack queued before the test leaves on the wire, not through loopback.
+	model.tx_deferred = 1;
+	CHECK(tx_data(make_tx_skb(60, 7), i82540EM_dev->net_dev) == NETDEV_TX_OK);
+	ops->self_test(i82540EM_dev->net_dev, &eth_test, data);
+	CHECK(data[0] == 0 && data[1] == selftest_frames);
+	CHECK(model.tx_frame_count == 1 && check_tx_frame(0, 60, 7));
+	model.tx_frame_count = 0;
+
+	// Writing the frame size parameter mid-run doesn't affect the run.
+	selftest_frame_size = 1514;
+	model.loopback_frames = 0;
+	model.loopback_hook = selftest_resize_hook;
+	ops->self_test(i82540EM_dev->net_dev, &eth_test, data);
+	CHECK(data[0] == 0 && data[1] == selftest_frames);
+	model.loopback_hook = 0;
+	selftest_frame_size = 60;
+
+	// One frame lost in loopback is one error, later frames still check out.
+	model.loopback_frames = 0;
+	model.loopback_drop = 10;
+	ops->self_test(i82540EM_dev->net_dev, &eth_test, data);
+	CHECK(eth_test.flags & ETH_TEST_FL_FAILED);
+	CHECK(data[0] == 1 && data[1] == selftest_frames - 1);
+	CHECK(i82540EM_dev->selftest_errors == 1);
+	model.loopback_drop = 0;
+	eth_test.flags = ETH_TEST_FL_OFFLINE;
+
+	// A transmit ring that never drains fails the test before loopback is set up.
+	model.tx_stalled = 1;
+	CHECK(tx_data(make_tx_skb(60, 8), i82540EM_dev->net_dev) == NETDEV_TX_OK);
+	ops->self_test(i82540EM_dev->net_dev, &eth_test, data);
+	CHECK(eth_test.flags & ETH_TEST_FL_FAILED);
+	CHECK(data[0] == 1 && data[1] == 0);
+	CHECK(model.phy_regs[i82540EM_PHY_CTRL] == phy_ctrl);
+	model.tx_stalled = 0;
+	writel(model_reg(i82540EM_TDT), i82540EM_dev->regs + i82540EM_TDT);
+	model.tx_frame_count = 0;
+	eth_test.flags = ETH_TEST_FL_OFFLINE;
+
+	// No PHY access: the test fails without touching the link.
+	model.mdic_error = 1;
+	ops->self_test(i82540EM_dev->net_dev, &eth_test, data);
+	CHECK(eth_test.flags & ETH_TEST_FL_FAILED);
+	CHECK(data[0] == 1 && data[1] == 0);
+	CHECK(model_reg(i82540EM_CTRL) == ctrl && model_reg(i82540EM_IMS) == ims);
+	CHECK(!i82540EM_dev->net_dev->queue_stopped);
+	model.mdic_error = 0;
+	eth_test.flags = ETH_TEST_FL_OFFLINE;
+
+	// Normal reception still works.
+	CHECK(!model_rx_frame(frame, make_frame(frame, 500, 9)));
+	model_irq();
+	skb = model_rx_pop();
+	CHECK(check_rx_skb(skb, 500, 9));
+	kfree_skb(skb);
+
+	// Bursts too large for the timeout are refused up front.
+	selftest_frames = i82540EM_SETTING_SELFTEST_FRAMES_MAX + 1;
+	ops->self_test(i82540EM_dev->net_dev, &eth_test, data);
+	CHECK(eth_test.flags & ETH_TEST_FL_FAILED);
+	CHECK(data[0] == 1 && data[1] == 0 && model.tx_frame_count == 0);
+	eth_test.flags = ETH_TEST_FL_OFFLINE;
+
+	// The largest burst passes.
+	selftest_frames = i82540EM_SETTING_SELFTEST_FRAMES_MAX;
+	ops->self_test(i82540EM_dev->net_dev, &eth_test, data);
+	CHECK(!(eth_test.flags & ETH_TEST_FL_FAILED));
+	CHECK(data[0] == 0 && data[1] == selftest_frames);
+
+	// A device that never transmits fails the test after the timeout.
+	selftest_frames = 16;
+	model.tx_stalled = 1;
+	ops->self_test(i82540EM_dev->net_dev, &eth_test, data);
+	CHECK(eth_test.flags & ETH_TEST_FL_FAILED);
+	CHECK(data[0] == 1 && data[1] == 0);
+
+	selftest_frames = saved_frames;
+	selftest_frame_size = saved_size;
+	test_remove();
+
+	// Small receive buffers: every frame takes several descriptors, the
+	// default burst must still fit the RX ring.
+	for(i = 0; i < ARRAY_SIZE(sizes); i++){
+
+		rx_buffer_size = sizes[i];
+		i82540EM_dev = test_probe();
+		CHECK(i82540EM_dev);
+		ops = i82540EM_dev->net_dev->ethtool_ops;
+
+		eth_test.flags = ETH_TEST_FL_OFFLINE;
+		ops->self_test(i82540EM_dev->net_dev, &eth_test, data);
+		CHECK(!(eth_test.flags & ETH_TEST_FL_FAILED));
+		CHECK(data[0] == 0 && data[1] == selftest_frames && model.rx_missed == 0);
+
+		test_remove();
+	}
+	rx_buffer_size = saved_buffer_size;
+}
+
+static void test_tx_single_frame(void){
+
+	struct i82540EM *i82540EM_dev = test_probe();
+
+	CHECK(i82540EM_dev);
+
+	CHECK(tx_data(make_tx_skb(60, 3), i82540EM_dev->net_dev) == NETDEV_TX_OK);
+	CHECK(model.tx_frame_count == 1);
+	CHECK(check_tx_frame(0, 60, 3));
+	CHECK(model_reg(i82540EM_TDT) == 1);
+	CHECK(model_reg(i82540EM_TDH) == 1);
+
+	// Ring space comes from descriptor write-back, not a TDH read.
+	CHECK(model.tdh_reads == 0);
+
+	test_remove();
+}
+
+static void test_tx_wraparound(void){
+
+	struct i82540EM *i82540EM_dev = test_probe();
+	unsigned int i;
+
+	CHECK(i82540EM_dev);
+
+	for(i = 0; i < 3 * i82540EM_SETTING_TX_BUFFER_COUNT + 17; i++){
+		CHECK(tx_data(make_tx_skb(60 + i % 1455, i), i82540EM_dev->net_dev) == NETDEV_TX_OK);
+		if(model.tx_frame_count == MODEL_TX_CAPTURE)
+			model.tx_frame_count = 0;
+	}
+
+	CHECK(model.tx_descriptors_consumed == i);
+	CHECK(model_reg(i82540EM_TDT) == i % i82540EM_SETTING_TX_BUFFER_COUNT);
+	CHECK(check_tx_frame(model.tx_frame_count - 1, 60 + (i - 1) % 1455, i - 1));
+
+	test_remove();
+}
+
+static void test_tx_ring_full(void){
+
+	struct i82540EM *i82540EM_dev = test_probe();
+	struct sk_buff *skb;
+	unsigned int i, queued = 0;
+
+	CHECK(i82540EM_dev);
+
+	// Device stops consuming descriptors, the driver must report busy before it overruns the ring.
+	model.tx_stalled = 1;
+	for(i = 0; i < i82540EM_SETTING_TX_BUFFER_COUNT + 10; i++){
+		skb = make_tx_skb(100, i);
+		if(tx_data(skb, i82540EM_dev->net_dev) != NETDEV_TX_OK){
+			kfree_skb(skb);
+			break;
+		}
+		queued++;
+	}
+	CHECK(queued == i82540EM_SETTING_TX_BUFFER_COUNT - 1);
+
+	// Every queued frame must make it out once the device resumes.
+	model.tx_stalled = 0;
+	model_tx_kick();
+	CHECK(model.tx_frame_count == queued);
+	for(i = 0; i < queued; i++)
+		CHECK(check_tx_frame(i, 100, i));
+
+	CHECK(tx_data(make_tx_skb(100, 999), i82540EM_dev->net_dev) == NETDEV_TX_OK);
+	CHECK(check_tx_frame(queued, 100, 999));
+
+	test_remove();
+}
+
+int main(void){
+
+	test_probe_programs_rings();
+	test_probe_dma_mask();
+	test_probe_programs_thresholds();
+	test_rx_single_frame();
+	test_rx_wraparound();
+	test_rx_multi_descriptor();
+	test_rx_small_buffers();
+	test_rx_ring_full();
+	test_rx_copybreak();
+	test_rx_page_flip();
+	test_rx_copybreak_runtime();
+	test_numa_placement();
+	test_selftest_loopback();
+	test_tx_single_frame();
+	test_tx_wraparound();
+	test_tx_ring_full();
+
+	if(failures){
+		fprintf(stderr, "ring_test: %d failure(s)\n", failures);
+		return 1;
+	}
+
+	printf("ring_test: all tests passed\n");
+	return 0;
+}
@@ -0,0 +1,710 @@
+#include <time.h>
+#include <x86intrin.h>
+
+#include "shim.h"
+#include "model.h"
+#include "../main.h"
+
+struct model model;
+
+// Padding reserved in front of skb data, like NET_SKB_PAD.
+#define SHIM_SKB_PAD 32
+
+// PHY power-on defaults: auto-negotiation on, 1000 Mb/s full duplex.
+static void model_phy_reset(void){
+
+	memset(model.phy_regs, 0, sizeof(model.phy_regs));
+	model.phy_regs[i82540EM_PHY_CTRL] = i82540EM_PHY_CTRL_BITMASK_AN_EN | i82540EM_PHY_CTRL_BITMASK_FD | i82540EM_PHY_CTRL_BITMASK_SPEED_MSB;
+}
+
+static void model_mdic(u32 value){
+
+	u32 reg = (value >> i82540EM_MDIC_SHIFT_REGADD) & 0x1F;
+	u32 phy = (value >> i82540EM_MDIC_SHIFT_PHYADD) & 0x1F;
+
+	if(model.mdic_error || phy != i82540EM_PHY_ADDRESS){
+		model.regs[i82540EM_MDIC / 4] = value | i82540EM_MDIC_BITMASK_R | i82540EM_MDIC_BITMASK_E;
+		return;
+	}
+
+	if(value & i82540EM_MDIC_OP_WRITE){
+		model.phy_regs[reg] = value & i82540EM_MDIC_BITMASK_DATA;
+		// Restart auto-negotiation self-clears.
+		if(reg == i82540EM_PHY_CTRL)
+			model.phy_regs[reg] &= ~i82540EM_PHY_CTRL_BITMASK_RESTART_AN;
+	}else{
+		value &= ~i82540EM_MDIC_BITMASK_DATA;
+		value |= model.phy_regs[reg];
+	}
+
+	model.regs[i82540EM_MDIC / 4] = value | i82540EM_MDIC_BITMASK_R;
+}
+
+void model_reset(void){
+
+	struct sk_buff *skb;
+
+	while((skb = model_rx_pop()))
+		kfree_skb(skb);
+
+	memset(&model, 0, sizeof(model));
+	model_phy_reset();
+}
+
+u32 model_reg(u32 offset){
+	return model.regs[offset / 4];
+}
+
+void model_set_reg(u32 offset, u32 value){
+	model.regs[offset / 4] = value;
+}
+
+static void *model_dma_to_virt(const char *buffer_address){
+	return (void*)(uintptr_t)*(const u64*)buffer_address;
+}
+
+static void *model_ring_base(u32 high_offset, u32 low_offset){
+	return (void*)(uintptr_t)((u64)model_reg(high_offset) << 32 | model_reg(low_offset));
+}
+
+static unsigned int model_rx_buffer_size(void){
+
+	static const unsigned int sizes[]          = {2048, 1024, 512, 256};
+	static const unsigned int extended_sizes[] = {0, 16384, 8192, 4096};
+	u32 rctl = model_reg(i82540EM_RCTL);
+	u32 bsize = (rctl & i82540EM_RCTL_BITMASK_BSIZE) >> 16;
+
+	return rctl & i82540EM_RCTL_BITMASK_BSEX ? extended_sizes[bsize] : sizes[bsize];
+}
+
+static unsigned int model_ring_count(u32 length_offset, unsigned int descriptor_size){
+	return model_reg(length_offset) / descriptor_size;
+}
+
+// Consume descriptors from TDH to TDT, assembling frames up to EOP.
+void model_tx_kick(void){
+
+	unsigned int count = model_ring_count(i82540EM_TDLEN, sizeof(struct i82540EM_tx_descriptor));
+	struct i82540EM_tx_descriptor *ring = model_ring_base(i82540EM_TDBAH, i82540EM_TDBAL);
+	static struct model_frame frame;
+	u32 head = model_reg(i82540EM_TDH);
+	u32 tail = model_reg(i82540EM_TDT);
+	int reported = 0;
+
+	if(!count || !(model_reg(i82540EM_TCTL) & i82540EM_TCTL_BITMASK_EN))
+		return;
+
+	while(head != tail){
+
+		struct i82540EM_tx_descriptor *descriptor = ring + head;
+
+		if(frame.length + descriptor->length <= MODEL_MAX_FRAME){
+			memcpy(frame.data + frame.length, model_dma_to_virt(descriptor->buffer_address), descriptor->length);
+			frame.length += descriptor->length;
+		}
+
+		if(descriptor->command & i82540EM_TX_COMMAND_BITMASK_EOP){
+
+			// PHY loopback: the frame goes to the receiver instead of the wire,
+			// FCS included unless the receiver strips it. Without IFCS there
+			// is no valid FCS and the receiver drops the frame.
+			if(model.phy_regs[i82540EM_PHY_CTRL] & i82540EM_PHY_CTRL_BITMASK_LOOPBACK){
+				if(!(descriptor->command & i82540EM_TX_COMMAND_BITMASK_IFCS)){
+					model.rx_crc_errors++;
+				}else if(++model.loopback_frames != model.loopback_drop){
+					if(!(model_reg(i82540EM_RCTL) & i82540EM_RCTL_BITMASK_SECRC) && frame.length + ETH_FCS_LEN <= MODEL_MAX_FRAME){
+						memset(frame.data + frame.length, 0xFC, ETH_FCS_LEN);
+						frame.length += ETH_FCS_LEN;
+					}
+					model_rx_frame(frame.data, frame.length);
+					if(model.loopback_hook)
+						model.loopback_hook(model.loopback_frames);
+				}
+			}else if(model.tx_frame_count < MODEL_TX_CAPTURE)
+				model.tx_frames[model.tx_frame_count++] = frame;
+
+			frame.length = 0;
+		}
+
+		if(descriptor->command & i82540EM_TX_COMMAND_BITMASK_RS){
+			descriptor->status |= i82540EM_TX_STATUS_BITMASK_DD;
+			reported = 1;
+		}
+
+		model.tx_descriptors_consumed++;
+		head = (head + 1) % count;
+	}
+
+	model_set_reg(i82540EM_TDH, head);
+
+	model.regs[i82540EM_ICR / 4] |= i82540EM_INTERRUPT_BITMASK_TXQE;
+	if(reported)
+		model.regs[i82540EM_ICR / 4] |= i82540EM_INTERRUPT_BITMASK_TXDW;
+}
+
+int model_rx_frame(const void *data, unsigned int length){
+
+	unsigned int count = model_ring_count(i82540EM_RDLEN, sizeof(struct i82540EM_rx_descriptor));
+	struct i82540EM_rx_descriptor *ring = model_ring_base(i82540EM_RDBAH, i82540EM_RDBAL);
+	unsigned int buffer_size = model_rx_buffer_size();
+	unsigned int needed = (length + buffer_size - 1) / buffer_size;
+	unsigned int available, free_after, threshold;
+	u32 head = model_reg(i82540EM_RDH);
+	u32 tail = model_reg(i82540EM_RDT);
+	const unsigned char *bytes = data;
+
+	if(!count || !(model_reg(i82540EM_RCTL) & i82540EM_RCTL_BITMASK_EN))
+		return -1;
+
+	// Descriptors from RDH up to, not including, RDT belong to hardware.
+	available = (tail + count - head) % count;
+	if(available < needed){
+		model.rx_missed++;
+		model.regs[i82540EM_ICR / 4] |= i82540EM_INTERRUPT_BITMASK_RXO;
+		return -1;
+	}
+
+	while(length){
+
+		struct i82540EM_rx_descriptor *descriptor = ring + head;
+		unsigned int chunk = length < buffer_size ? length : buffer_size;
+
+		memcpy(model_dma_to_virt(descriptor->buffer_address), bytes, chunk);
+		bytes  += chunk;
+		length -= chunk;
+
+		descriptor->length = chunk;
+		descriptor->errors = 0;
+		descriptor->status = i82540EM_RX_STATUS_BITMASK_DD | (length ? 0 : i82540EM_RX_STATUS_BITMASK_EOP);
+
+		model.rx_descriptors_written++;
+		head = (head + 1) % count;
+	}
+
+	model_set_reg(i82540EM_RDH, head);
+	model.regs[i82540EM_ICR / 4] |= i82540EM_INTERRUPT_BITMASK_RXT0;
+
+	// RDMTS: 00 = 1/2, 01 = 1/4, 10 = 1/8 of the ring.
+	free_after = (tail + count - head) % count;
+	threshold = count >> (1 + ((model_reg(i82540EM_RCTL) & i82540EM_RCTL_BITMASK_RDMTS) >> 8));
+	if(free_after <= threshold)
+		model.regs[i82540EM_ICR / 4] |= i82540EM_INTERRUPT_BITMASK_RXDMT0;
+
+	return 0;
+}
+
+void model_irq(void){
+
+	struct tasklet_struct *tasklet;
+
+	if(model.irq_handler && (model_reg(i82540EM_ICR) & model_reg(i82540EM_IMS)))
+		model.irq_handler(0, model.irq_dev_id);
+
+	while((tasklet = model.tasklet) && tasklet->scheduled && !tasklet->disabled){
+		tasklet->scheduled = 0;
+		local_bh_disable();
+		tasklet->func(tasklet->data);
+		local_bh_enable();
+	}
+}
+
+struct sk_buff *model_rx_pop(void){
+
+	struct sk_buff *skb = model.rx_queue_head;
+
+	if(skb){
+		model.rx_queue_head = skb->next;
+		if(!model.rx_queue_head)
+			model.rx_queue_tail = 0;
+		model.rx_queue_length--;
+		skb->next = 0;
+	}
+
+	return skb;
+}
+
+// MMIO.
+
+u32 readl(const void *addr){
+
+	u32 offset = (const char*)addr - (const char*)model.regs;
+	u32 value = model.regs[offset / 4];
+
+	// Interrupt causes are cleared by reading ICR.
+	if(offset == i82540EM_ICR)
+		model.regs[offset / 4] = 0;
+
+	if(offset == i82540EM_TDH)
+		model.tdh_reads++;
+
+	// Deferred transmit catches up before TDH is reported.
+	if(offset == i82540EM_TDH && model.tx_deferred && !model.tx_stalled && value != model_reg(i82540EM_TDT)){
+		model.tx_deferred = 0;
+		model_tx_kick();
+		value = model.regs[offset / 4];
+	}
+
+	return value;
+}
+
+void writel(u32 value, void *addr){
+
+	u32 offset = (char*)addr - (char*)model.regs;
+
+	switch(offset){
+
+	case i82540EM_CTRL:
+		// Reset clears every register and the bit self-clears.
+		if(value & i82540EM_CTRL_BITMASK_RST){
+			memset(model.regs, 0, sizeof(model.regs));
+			model_phy_reset();
+			return;
+		}
+		break;
+
+	case i82540EM_MDIC:
+		model_mdic(value);
+		return;
+
+	case i82540EM_ICR:
+		// Write one to clear.
+		model.regs[offset / 4] &= ~value;
+		return;
+
+	case i82540EM_ICS:
+		model.regs[i82540EM_ICR / 4] |= value;
+		return;
+
+	case i82540EM_IMS:
+		model.regs[offset / 4] |= value;
+		return;
+
+	case i82540EM_IMC:
+		model.regs[i82540EM_IMS / 4] &= ~value;
+		return;
+
+	case i82540EM_TDT:
+		model.regs[offset / 4] = value;
+		if(!model.tx_stalled && !model.tx_deferred)
+			model_tx_kick();
+		return;
+	}
+
+	model.regs[offset / 4] = value;
+}
+
+// PCI.
+
+int pci_enable_device(struct pci_dev *pci_dev){
+	pci_dev->enabled = 1;
+	return 0;
+}
+
+void pci_disable_device(struct pci_dev *pci_dev){
+	pci_dev->enabled = 0;
+}
+
+int pci_is_enabled(struct pci_dev *pci_dev){
+	return pci_dev->enabled;
+}
+
+int pci_request_regions(struct pci_dev *pci_dev, const char *name){
+	return 0;
+}
+
+void pci_release_regions(struct pci_dev *pci_dev){
+}
+
+void pci_set_master(struct pci_dev *pci_dev){
+}
+
+void *pci_ioremap_bar(struct pci_dev *pci_dev, int bar){
+	return model.regs;
+}
+
+void iounmap(void *addr){
+}
+
+// Memory and pages.
+
+void *kcalloc(size_t n, size_t size, gfp_t gfp){
+	return calloc(n, size);
+}
+
+void kfree(const void *p){
+	free((void*)p);
+}
+
+long shim_pages;
+
+struct page *dev_alloc_page(void){
+	return alloc_pages_node(NUMA_NO_NODE, GFP_ATOMIC, 0);
+}
+
+// No node given means the local node, which is node 0 here.
+struct page *alloc_pages_node(int nid, gfp_t gfp, unsigned int order){
+
+	struct page *page = calloc(1, sizeof(*page));
+
+	if(!page)
+		return 0;
+
+	page->nid = nid == NUMA_NO_NODE ? 0 : nid;
+
+	page->address = aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+	if(!page->address){
+		free(page);
+		return 0;
+	}
+
+	page->refcount = 1;
+	shim_pages++;
+	return page;
+}
+
+void put_page(struct page *page){
+
+	if(--page->refcount)
+		return;
+
+	free(page->address);
+	free(page);
+	shim_pages--;
+}
+
+void __free_page(struct page *page){
+	put_page(page);
+}
+
+// DMA.
+
+int dma_set_mask_and_coherent(struct device *dev, u64 mask){
+
+	if(model.dma_mask_limit && mask > model.dma_mask_limit)
+		return -EIO;
+
+	dev->dma_mask = mask;
+	return 0;
+}
+
+long shim_dma_mapped;
+
+dma_addr_t dma_map_page_attrs(struct device *dev, struct page *page, size_t offset, size_t size, enum dma_data_direction direction, unsigned long attrs){
+
+	shim_dma_mapped += size;
+	return dma_map_page(dev, page, offset, size, direction);
+}
+
+void dma_unmap_page_attrs(struct device *dev, dma_addr_t handle, size_t size, enum dma_data_direction direction, unsigned long attrs){
+	shim_dma_mapped -= size;
+}
+
+void *dma_alloc_coherent(struct device *dev, size_t size, dma_addr_t *handle, gfp_t gfp){
+
+	void *memory = aligned_alloc(4096, (size + 4095) & ~(size_t)4095);
+
+	if(memory){
+		memset(memory, 0, size);
+		*handle = (dma_addr_t)(uintptr_t)memory;
+	}
+
+	return memory;
+}
+
+void dma_free_coherent(struct device *dev, size_t size, void *cpu_addr, dma_addr_t handle){
+	free(cpu_addr);
+}
+
+// Time.
+
+unsigned long shim_jiffies(void){
+	return ktime_get_ns() / 1000000;
+}
+
+u64 ktime_get_ns(void){
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+cycles_t get_cycles(void){
+	return __rdtsc();
+}
+
+// Interrupts and tasklets.
+
+int request_irq(unsigned int irq, irq_handler_t handler, unsigned long flags, const char *name, void *dev_id){
+
+	model.irq_handler = handler;
+	model.irq_dev_id = dev_id;
+
+	return 0;
+}
+
+void free_irq(unsigned int irq, void *dev_id){
+
+	model.irq_handler = 0;
+	model.irq_dev_id = 0;
+}
+
+int irq_set_affinity_hint(unsigned int irq, const struct cpumask *mask){
+
+	model.irq_affinity_hint = mask;
+	return 0;
+}
+
+const struct cpumask *cpumask_of_node(int node){
+
+	static struct cpumask masks[MAX_NUMNODES];
+
+	masks[node].node = node;
+	return &masks[node];
+}
+
+void tasklet_init(struct tasklet_struct *tasklet, void (*func)(unsigned long), unsigned long data){
+
+	tasklet->func = func;
+	tasklet->data = data;
+	tasklet->scheduled = 0;
+}
+
+int shim_bh_disabled;
+
+void tasklet_hi_schedule(struct tasklet_struct *tasklet){
+
+	tasklet->scheduled = 1;
+	model.tasklet = tasklet;
+}
+
+// Socket buffers.
+
+struct sk_buff *dev_alloc_skb(unsigned int length){
+
+	struct sk_buff *skb = calloc(1, sizeof(*skb));
+
+	if(!skb)
+		return 0;
+
+	skb->head = malloc(SHIM_SKB_PAD + length);
+	if(!skb->head){
+		free(skb);
+		return 0;
+	}
+
+	skb->data = skb->head + SHIM_SKB_PAD;
+	skb->tail = SHIM_SKB_PAD;
+	skb->end  = SHIM_SKB_PAD + length;
+
+	return skb;
+}
+
+struct sk_buff *netdev_alloc_skb(struct net_device *dev, unsigned int length){
+
+	struct sk_buff *skb = dev_alloc_skb(length);
+
+	if(skb)
+		skb->dev = dev;
+
+	return skb;
+}
+
+struct sk_buff *netdev_alloc_skb_ip_align(struct net_device *dev, unsigned int length){
+
+	struct sk_buff *skb = dev_alloc_skb(length + NET_IP_ALIGN);
+
+	if(skb){
+		skb->data += NET_IP_ALIGN;
+		skb->tail += NET_IP_ALIGN;
+		skb->dev = dev;
+	}
+
+	return skb;
+}
+
+void kfree_skb(struct sk_buff *skb){
+
+	int i;
+
+	if(!skb)
+		return;
+
+	for(i = 0; i < skb_shinfo(skb)->nr_frags; i++)
+		put_page(skb_shinfo(skb)->frags[i].page);
+
+	free(skb->head);
+	free(skb);
+}
+
+unsigned char *skb_put(struct sk_buff *skb, unsigned int len){
+
+	unsigned char *tail = skb->head + skb->tail;
+
+	// Same check as the kernel's skb_over_panic().
+	if(skb->tail + len > skb->end){
+		fprintf(stderr, "skb_put(): skb_over_panic: len %u put %u end %u\n", skb->len, len, skb->end - SHIM_SKB_PAD);
+		abort();
+	}
+
+	skb->tail += len;
+	skb->len  += len;
+
+	return tail;
+}
+
+void skb_add_rx_frag(struct sk_buff *skb, int i, struct page *page, int off, int size, unsigned int truesize){
+
+	if(i >= MAX_SKB_FRAGS){
+		fprintf(stderr, "skb_add_rx_frag(): fragment %d out of range\n", i);
+		abort();
+	}
+
+	skb_shinfo(skb)->frags[i].page = page;
+	skb_shinfo(skb)->frags[i].page_offset = off;
+	skb_shinfo(skb)->frags[i].size = size;
+	skb_shinfo(skb)->nr_frags = i + 1;
+
+	skb->len      += size;
+	skb->data_len += size;
+	skb->truesize += truesize;
+}
+
+int skb_copy_bits(const struct sk_buff *skb, int offset, void *to, int len){
+
+	unsigned char *out = to;
+	int headlen = skb_headlen(skb);
+	int i;
+
+	if(offset + len > (int)skb->len)
+		return -1;
+
+	// Linear part first, then the fragments in order.
+	for(; len && offset < headlen; offset++, len--)
+		*out++ = skb->data[offset];
+	offset -= headlen;
+
+	for(i = 0; len && i < skb_shinfo(skb)->nr_frags; i++){
+
+		const skb_frag_t *frag = &skb_shinfo(skb)->frags[i];
+		int chunk;
+
+		if(offset >= (int)frag->size){
+			offset -= frag->size;
+			continue;
+		}
+
+		chunk = frag->size - offset < (unsigned int)len ? frag->size - offset : len;
+		memcpy(out, (unsigned char*)frag->page->address + frag->page_offset + offset, chunk);
+		out += chunk;
+		len -= chunk;
+		offset = 0;
+	}
+
+	return 0;
+}
+
+// Network devices.
+
+struct net_device *alloc_etherdev(int sizeof_priv){
+
+	struct net_device *dev = calloc(1, sizeof(*dev));
+
+	if(!dev)
+		return 0;
+
+	dev->priv = calloc(1, sizeof_priv);
+	if(!dev->priv){
+		free(dev);
+		return 0;
+	}
+
+	return dev;
+}
+
+void free_netdev(struct net_device *dev){
+
+	free(dev->priv);
+	free(dev);
+}
+
+int register_netdev(struct net_device *dev){
+	return 0;
+}
+
+void unregister_netdev(struct net_device *dev){
+}
+
+void *netdev_priv(const struct net_device *dev){
+	return dev->priv;
+}
+
+u16 eth_type_trans(struct sk_buff *skb, struct net_device *dev){
+
+	u16 protocol;
+
+	// The kernel requires the ethernet header in the linear area.
+	if(skb_headlen(skb) < ETH_HLEN){
+		fprintf(stderr, "eth_type_trans(): only %u linear bytes\n", skb_headlen(skb));
+		abort();
+	}
+
+	// Ethertype in network byte order, like the kernel returns it.
+	memcpy(&protocol, skb->data + 12, sizeof(protocol));
+
+	skb->dev = dev;
+	skb->data += 14;
+	skb->len  -= 14;
+
+	return protocol;
+}
+
+// The kernel dissects up to the transport header. The ethernet header is all the ring code relies on.
+u32 eth_get_headlen(const struct net_device *dev, void *data, unsigned int len){
+	return len < ETH_HLEN ? len : ETH_HLEN;
+}
+
+int netif_rx(struct sk_buff *skb){
+
+	// From process context this would leave the NET_RX softirq pending.
+	if(!shim_bh_disabled)
+		model.netif_rx_bh_enabled++;
+
+	skb->next = 0;
+	if(model.rx_queue_tail)
+		model.rx_queue_tail->next = skb;
+	else
+		model.rx_queue_head = skb;
+	model.rx_queue_tail = skb;
+	model.rx_queue_length++;
+
+	return 0;
+}
+
+// uart_print.c does port I/O on COM1. Route it to stderr when asked to.
+
+void uart_print(char *fmt, ...){
+
+	static int verbose = -1;
+	va_list args;
+
+	if(verbose < 0)
+		verbose = getenv("HARNESS_VERBOSE") != 0;
+	if(!verbose)
+		return;
+
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+}
+
+void buffer_uart_print(char *buffer, uint length, uint columns){
+
+	uint i;
+
+	for(i = 1; i < length + 1; i++){
+		uart_print("%.2hhx ", buffer[i - 1]);
+		if(i % columns == 0)
+			uart_print("\n");
+	}
+}
@@ -0,0 +1,331 @@
+#ifndef i82540EM_SHIM_H
+#define i82540EM_SHIM_H
+
+// Userspace stand-ins for the kernel APIs used by main.c.
+// Just enough to compile the driver unmodified and run it against the
+// register/DMA model in shim.c. Kernel headers included by main.c resolve
+// to include/linux/*.h, which all pull in this file.
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef unsigned int uint;
+typedef u64 dma_addr_t;
+typedef u64 phys_addr_t;
+typedef unsigned int gfp_t;
+
+#define GFP_KERNEL	0
+#define GFP_ATOMIC	1
+#define __GFP_NOWARN	0x200
+#define __GFP_COMP	0x4000
+#define __GFP_MEMALLOC	0x20000
+
+#define EIO		5
+#define ENOMEM		12
+#define EBUSY		16
+#define EINVAL		22
+#define EOPNOTSUPP	95
+#define ETIMEDOUT	110
+
+// Module boilerplate. Parameters are plain globals the tests can poke.
+#define MODULE_LICENSE(license)
+#define MODULE_PARM_DESC(name, description)
+#define module_param(name, type, permissions)
+#define module_pci_driver(driver)
+
+#define unlikely(x)		(x)
+#define likely(x)		(x)
+#define ARRAY_SIZE(a)		(sizeof(a) / sizeof((a)[0]))
+#define READ_ONCE(x)		(*(volatile __typeof__(x)*)&(x))
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+#define min_t(type, a, b)	((type)(a) < (type)(b) ? (type)(a) : (type)(b))
+
+// Memory.
+void *kcalloc(size_t n, size_t size, gfp_t gfp);
+void  kfree(const void *p);
+
+#define kcalloc_node(n, size, gfp, node) kcalloc(n, size, gfp)
+
+// NUMA. Nodes only exist as numbers the tests can check placement against.
+#define NUMA_NO_NODE	(-1)
+#define MAX_NUMNODES	4
+
+struct cpumask{
+	int node;
+};
+
+const struct cpumask *cpumask_of_node(int node);
+
+// Compiler and memory barriers. The model runs synchronously, a compiler barrier is enough.
+#define wmb()	__asm__ __volatile__("" ::: "memory")
+#define rmb()	__asm__ __volatile__("" ::: "memory")
+#define mb()	__asm__ __volatile__("" ::: "memory")
+
+#define udelay(us)
+#define cpu_relax()
+
+// Time. jiffies tick in milliseconds.
+#define HZ			1000
+#define NSEC_PER_SEC		1000000000ULL
+#define jiffies			shim_jiffies()
+#define msecs_to_jiffies(ms)	((unsigned long)(ms))
+#define time_after(a, b)	((long)((b) - (a)) < 0)
+#define div64_u64(a, b)		((a) / (b))
+
+typedef u64 cycles_t;
+
+unsigned long shim_jiffies(void);
+u64 ktime_get_ns(void);
+cycles_t get_cycles(void);
+
+// Locking. Everything is single threaded.
+typedef struct { int unused; } spinlock_t;
+#define spin_lock_init(lock)
+#define spin_lock(lock)
+#define spin_unlock(lock)
+#define spin_lock_irqsave(lock, flags)		((void)(flags))
+#define spin_unlock_irqrestore(lock, flags)	((void)(flags))
+
+// Generic device and PCI.
+struct device{
+	int numa_node;
+	u64 dma_mask;
+};
+
+#define dev_to_node(dev) ((dev)->numa_node)
+
+struct pci_dev{
+	struct device dev;
+	unsigned int irq;
+	int enabled;
+	void *drvdata;
+};
+
+struct pci_device_id{
+	u32 vendor, device;
+};
+
+#define PCI_DEVICE(vend, dev) .vendor = (vend), .device = (dev)
+
+struct pci_driver{
+	const char *name;
+	const struct pci_device_id *id_table;
+	int  (*probe)(struct pci_dev *dev, const struct pci_device_id *id);
+	void (*remove)(struct pci_dev *dev);
+};
+
+#define dev_err(dev, ...)  fprintf(stderr, __VA_ARGS__)
+#define dev_warn(dev, ...) fprintf(stderr, __VA_ARGS__)
+
+int   pci_enable_device(struct pci_dev *pci_dev);
+void  pci_disable_device(struct pci_dev *pci_dev);
+int   pci_is_enabled(struct pci_dev *pci_dev);
+int   pci_request_regions(struct pci_dev *pci_dev, const char *name);
+void  pci_release_regions(struct pci_dev *pci_dev);
+void  pci_set_master(struct pci_dev *pci_dev);
+void *pci_ioremap_bar(struct pci_dev *pci_dev, int bar);
+void  iounmap(void *addr);
+
+#define pci_set_drvdata(pci_dev, data)	((pci_dev)->drvdata = (data))
+#define pci_get_drvdata(pci_dev)	((pci_dev)->drvdata)
+
+// MMIO. Routed to the register model.
+u32  readl(const void *addr);
+void writel(u32 value, void *addr);
+
+// Pages. Reference counted, freed when the last reference goes.
+#define PAGE_SIZE 4096
+
+struct page{
+	int refcount;
+	int pfmemalloc;
+	int nid;
+	void *address;
+};
+
+// Pages currently allocated, for footprint checks.
+extern long shim_pages;
+
+struct page *dev_alloc_page(void);
+struct page *alloc_pages_node(int nid, gfp_t gfp, unsigned int order);
+void __free_page(struct page *page);
+void put_page(struct page *page);
+
+#define page_address(page)		((page)->address)
+#define page_ref_count(page)		((page)->refcount)
+#define page_ref_inc(page)		((page)->refcount++)
+#define page_is_pfmemalloc(page)	((page)->pfmemalloc)
+#define page_to_nid(page)		((page)->nid)
+
+// DMA. Bus addresses are plain virtual addresses, so the model can follow descriptors.
+enum dma_data_direction{
+	DMA_BIDIRECTIONAL	= 0,
+	DMA_TO_DEVICE		= 1,
+	DMA_FROM_DEVICE		= 2,
+};
+
+#define DMA_BIT_MASK(n)	(((n) == 64) ? ~0ULL : ((1ULL << (n)) - 1))
+
+int   dma_set_mask_and_coherent(struct device *dev, u64 mask);
+void *dma_alloc_coherent(struct device *dev, size_t size, dma_addr_t *handle, gfp_t gfp);
+void  dma_free_coherent(struct device *dev, size_t size, void *cpu_addr, dma_addr_t handle);
+
+#define DMA_ATTR_SKIP_CPU_SYNC	(1UL << 5)
+
+#define dma_map_page(dev, page, offset, size, direction)	((dma_addr_t)(uintptr_t)(page)->address + (offset))
+#define dma_unmap_page(dev, handle, size, direction)		((void)(handle))
+
+// Bytes currently covered by dma_map_page_attrs() mappings, for footprint checks.
+extern long shim_dma_mapped;
+
+dma_addr_t dma_map_page_attrs(struct device *dev, struct page *page, size_t offset, size_t size, enum dma_data_direction direction, unsigned long attrs);
+void dma_unmap_page_attrs(struct device *dev, dma_addr_t handle, size_t size, enum dma_data_direction direction, unsigned long attrs);
+#define dma_mapping_error(dev, handle)				((handle) == 0)
+#define dma_sync_single_range_for_cpu(dev, handle, offset, size, direction)
+#define dma_sync_single_range_for_device(dev, handle, offset, size, direction)
+
+#define virt_to_phys(addr) ((phys_addr_t)(uintptr_t)(addr))
+
+// Interrupts and tasklets.
+typedef int irqreturn_t;
+typedef irqreturn_t (*irq_handler_t)(int irq, void *dev_id);
+#define IRQ_NONE	0
+#define IRQ_HANDLED	1
+#define IRQ_RETVAL(x)	((x) ? IRQ_HANDLED : IRQ_NONE)
+#define IRQF_SHARED	0x80
+
+int  request_irq(unsigned int irq, irq_handler_t handler, unsigned long flags, const char *name, void *dev_id);
+void free_irq(unsigned int irq, void *dev_id);
+int  irq_set_affinity_hint(unsigned int irq, const struct cpumask *mask);
+
+struct tasklet_struct{
+	void (*func)(unsigned long data);
+	unsigned long data;
+	int scheduled;
+	int disabled;
+};
+
+// Bottom half nesting depth. Tasklets run with it raised.
+extern int shim_bh_disabled;
+#define local_bh_disable()	(shim_bh_disabled++)
+#define local_bh_enable()	(shim_bh_disabled--)
+
+void tasklet_init(struct tasklet_struct *tasklet, void (*func)(unsigned long), unsigned long data);
+void tasklet_hi_schedule(struct tasklet_struct *tasklet);
+#define tasklet_disable(tasklet)	((tasklet)->disabled++)
+#define tasklet_enable(tasklet)		((tasklet)->disabled--)
+
+// Socket buffers.
+#define CHECKSUM_NONE		0
+#define CHECKSUM_UNNECESSARY	1
+
+#define MAX_SKB_FRAGS		17
+#define NET_IP_ALIGN		2
+#define ETH_ALEN		6
+#define ETH_HLEN		14
+#define ETH_ZLEN		60
+#define ETH_FRAME_LEN		1514
+#define ETH_FCS_LEN		4
+
+struct net_device;
+
+typedef struct{
+	struct page *page;
+	unsigned int page_offset;
+	unsigned int size;
+} skb_frag_t;
+
+struct skb_shared_info{
+	unsigned char nr_frags;
+	skb_frag_t frags[MAX_SKB_FRAGS];
+};
+
+struct sk_buff{
+	unsigned char *head;
+	unsigned char *data;
+	unsigned int len;
+	unsigned int data_len;
+	unsigned int truesize;
+	unsigned int tail;
+	unsigned int end;
+	u8 ip_summed;
+	u16 protocol;
+	struct net_device *dev;
+	struct sk_buff *next;
+	struct skb_shared_info shinfo;
+};
+
+#define skb_shinfo(skb)		(&(skb)->shinfo)
+#define skb_headlen(skb)	((skb)->len - (skb)->data_len)
+
+struct sk_buff *dev_alloc_skb(unsigned int length);
+void kfree_skb(struct sk_buff *skb);
+unsigned char *skb_put(struct sk_buff *skb, unsigned int len);
+void skb_add_rx_frag(struct sk_buff *skb, int i, struct page *page, int off, int size, unsigned int truesize);
+int  skb_copy_bits(const struct sk_buff *skb, int offset, void *to, int len);
+
+// Network devices.
+typedef enum{
+	NETDEV_TX_OK	= 0x00,
+	NETDEV_TX_BUSY	= 0x10,
+} netdev_tx_t;
+
+struct net_device_ops{
+	netdev_tx_t (*ndo_start_xmit)(struct sk_buff *skb, struct net_device *dev);
+};
+
+// ethtool.
+#define ETH_GSTRING_LEN		32
+#define ETH_SS_TEST		0
+#define ETH_TEST_FL_OFFLINE	(1 << 0)
+#define ETH_TEST_FL_FAILED	(1 << 1)
+
+struct ethtool_test{
+	u32 cmd;
+	u32 flags;
+	u32 reserved;
+	u32 len;
+};
+
+struct ethtool_ops{
+	void (*self_test)(struct net_device *dev, struct ethtool_test *test, u64 *data);
+	int  (*get_sset_count)(struct net_device *dev, int sset);
+	void (*get_strings)(struct net_device *dev, u32 stringset, u8 *data);
+};
+
+struct net_device{
+	unsigned char dev_addr[6];
+	const struct net_device_ops *netdev_ops;
+	const struct ethtool_ops *ethtool_ops;
+	int running;
+	int queue_stopped;
+	struct device *parent;
+	void *priv;
+};
+
+#define SET_NETDEV_DEV(net, pdev) ((net)->parent = (pdev))
+
+struct net_device *alloc_etherdev(int sizeof_priv);
+void  free_netdev(struct net_device *dev);
+int   register_netdev(struct net_device *dev);
+void  unregister_netdev(struct net_device *dev);
+void *netdev_priv(const struct net_device *dev);
+
+#define netif_running(dev)	((dev)->running)
+#define netif_tx_disable(dev)	((dev)->queue_stopped = 1)
+#define netif_wake_queue(dev)	((dev)->queue_stopped = 0)
+
+struct sk_buff *netdev_alloc_skb(struct net_device *dev, unsigned int length);
+struct sk_buff *netdev_alloc_skb_ip_align(struct net_device *dev, unsigned int length);
+u16 eth_type_trans(struct sk_buff *skb, struct net_device *dev);
+u32 eth_get_headlen(const struct net_device *dev, void *data, unsigned int len);
+int netif_rx(struct sk_buff *skb);
+
+#endif // !(i82540EM_SHIM_H)
@@ -4,6 +4,7 @@
 #include <linux/etherdevice.h>
 #include <linux/pci.h>
 #include <linux/dma-mapping.h>
+#include <linux/ethtool.h>
 
 #include "main.h"
 #include "uart_print.h"
@@ -11,6 +12,7 @@
 MODULE_LICENSE("Dual BSD/GPL");
 
 static const struct net_device_ops i82540EM_net_ops;
+static const struct ethtool_ops i82540EM_ethtool_ops;
 
 static const struct pci_device_id i82540EM_pci_tbl[] = {
 	{PCI_DEVICE(i82540EM_VENDOR, i82540EM_DEVICE)},
@@ -34,7 +36,276 @@ static irqreturn_t i82540EM_isr(int irq, void* dev_id){
 	return IRQ_RETVAL(1);
 }
 
-// Tasklet function to copy data from buffers.
+// Copybreak threshold in bytes. Adjustable at runtime through
+// /sys/module/i82540EM/parameters/copybreak, 0 disables copying.
+static unsigned int copybreak = i82540EM_SETTING_RX_COPYBREAK;
+module_param(copybreak, uint, 0644);
+MODULE_PARM_DESC(copybreak, "Maximum size of packet that is copied to a new buffer on receive");
+
+// Receive buffer size, one of 256, 512, 1024 or 2048. Programmed into RCTL.BSIZE at probe.
+static unsigned int rx_buffer_size = i82540EM_SETTING_RX_BUFFER_SIZE;
+module_param(rx_buffer_size, uint, 0444);
+MODULE_PARM_DESC(rx_buffer_size, "Receive buffer size: 256, 512, 1024 or 2048. Larger frames span several descriptors");
+
+// Half-page buffers own their page and flip between its halves.
+// Smaller buffers are carved out of pages shared between descriptors.
+static int i82540EM_rx_buffers_flip(struct i82540EM *i82540EM_dev){
+	return i82540EM_dev->rx_buffer_size * 2 == PAGE_SIZE;
+}
+
+// Flipping buffers map their whole page, carved buffers only their own slot,
+// so slots sharing a page never overlap in the IOMMU or swiotlb.
+static unsigned int i82540EM_rx_map_size(struct i82540EM *i82540EM_dev){
+	return i82540EM_rx_buffers_flip(i82540EM_dev) ? PAGE_SIZE : i82540EM_dev->rx_buffer_size;
+}
+
+// Offset of the buffer within its mapping.
+static unsigned int i82540EM_rx_map_offset(struct i82540EM *i82540EM_dev, struct i82540EM_rx_buffer *rx_buffer){
+	return i82540EM_rx_buffers_flip(i82540EM_dev) ? rx_buffer->page_offset : 0;
+}
+
+// Get a fresh, mapped receive buffer.
+// Every buffer holds its own page reference and its own mapping, so it can be
+// handed to the stack or freed independently of its neighbours.
+// Mappings skip the CPU sync, only the buffer's own range is synced in rx_data().
+static int i82540EM_alloc_rx_buffer(struct i82540EM *i82540EM_dev, struct i82540EM_rx_buffer *rx_buffer){
+
+	struct page *page = i82540EM_dev->rx_refill_page;
+	unsigned int page_offset = i82540EM_dev->rx_refill_offset;
+	dma_addr_t dma;
+
+	// Same flags as dev_alloc_page(), but on the device's node rather than
+	// the node of whichever CPU happens to run the refill.
+	if(!page){
+		page = alloc_pages_node(i82540EM_dev->numa_node, GFP_ATOMIC | __GFP_NOWARN | __GFP_COMP | __GFP_MEMALLOC, 0);
+		if(!page)
+			return -ENOMEM;
+		page_offset = 0;
+	}
+
+	dma = dma_map_page_attrs(&i82540EM_dev->pci_dev->dev, page, i82540EM_rx_buffers_flip(i82540EM_dev) ? 0 : page_offset,
+				 i82540EM_rx_map_size(i82540EM_dev), DMA_FROM_DEVICE, DMA_ATTR_SKIP_CPU_SYNC);
+	if(dma_mapping_error(&i82540EM_dev->pci_dev->dev, dma)){
+		if(!i82540EM_dev->rx_refill_page)
+			__free_page(page);
+		return -ENOMEM;
+	}
+
+	rx_buffer->page = page;
+	rx_buffer->dma = dma;
+	rx_buffer->page_offset = page_offset;
+
+	// Carve the next buffer out of the same page. The refill state keeps
+	// its own reference until the last slot is handed out.
+	if(!i82540EM_rx_buffers_flip(i82540EM_dev)){
+
+		page_ref_inc(page);
+		i82540EM_dev->rx_refill_page = page;
+
+		i82540EM_dev->rx_refill_offset = page_offset + i82540EM_dev->rx_buffer_size;
+		if(i82540EM_dev->rx_refill_offset + i82540EM_dev->rx_buffer_size > PAGE_SIZE){
+			put_page(page);
+			i82540EM_dev->rx_refill_page = 0;
+		}
+	}
+
+	return 0;
+}
+
+static void i82540EM_free_rx_buffer(struct i82540EM *i82540EM_dev, struct i82540EM_rx_buffer *rx_buffer){
+
+	dma_unmap_page_attrs(&i82540EM_dev->pci_dev->dev, rx_buffer->dma, i82540EM_rx_map_size(i82540EM_dev), DMA_FROM_DEVICE, DMA_ATTR_SKIP_CPU_SYNC);
+	put_page(rx_buffer->page);
+	rx_buffer->page = 0;
+}
+
+// The other half of the page is free once the stack dropped its reference.
+// Pages from the emergency reserves are never kept, and neither are pages the
+// allocator had to place off the device's node. Shared pages never flip.
+static int i82540EM_can_flip_rx_buffer(struct i82540EM *i82540EM_dev, struct i82540EM_rx_buffer *rx_buffer){
+	return i82540EM_rx_buffers_flip(i82540EM_dev) && page_ref_count(rx_buffer->page) == 1 && !page_is_pfmemalloc(rx_buffer->page) &&
+		(i82540EM_dev->numa_node == NUMA_NO_NODE || page_to_nid(rx_buffer->page) == i82540EM_dev->numa_node);
+}
+
+// Point a receive descriptor at its buffer and give the buffer back to the device.
+static void i82540EM_arm_rx_buffer(struct i82540EM *i82540EM_dev, unsigned int i){
+
+	struct i82540EM_rx_buffer *rx_buffer = &i82540EM_dev->rx_buffers[i];
+
+	unsigned int map_offset = i82540EM_rx_map_offset(i82540EM_dev, rx_buffer);
+
+	dma_sync_single_range_for_device(&i82540EM_dev->pci_dev->dev, rx_buffer->dma, map_offset, i82540EM_dev->rx_buffer_size, DMA_FROM_DEVICE);
+	*(void**)(i82540EM_dev->rx_descriptors + i) = (void*)(rx_buffer->dma + map_offset);
+}
+
+// RCTL.BSIZE bits for the receive buffer size.
+static u32 i82540EM_rctl_bsize(struct i82540EM *i82540EM_dev){
+
+	switch(i82540EM_dev->rx_buffer_size){
+	case 256:
+		return i82540EM_RCTL_BSIZE_256;
+	case 512:
+		return i82540EM_RCTL_BSIZE_512;
+	case 1024:
+		return i82540EM_RCTL_BSIZE_1024;
+	default:
+		return i82540EM_RCTL_BSIZE_2048;
+	}
+}
+
+// Descriptor thresholds. Programmed at probe, so read-only afterwards.
+static unsigned int rx_pthresh = i82540EM_SETTING_RX_PTHRESH;
+module_param(rx_pthresh, uint, 0444);
+MODULE_PARM_DESC(rx_pthresh, "RXDCTL prefetch threshold in descriptors, 0-63");
+
+static unsigned int rx_hthresh = i82540EM_SETTING_RX_HTHRESH;
+module_param(rx_hthresh, uint, 0444);
+MODULE_PARM_DESC(rx_hthresh, "RXDCTL host threshold in descriptors, 0-63");
+
+static unsigned int rx_wthresh = i82540EM_SETTING_RX_WTHRESH;
+module_param(rx_wthresh, uint, 0444);
+MODULE_PARM_DESC(rx_wthresh, "RXDCTL write-back threshold in descriptors, 0-63. Above 1 enables the receive delay timers");
+
+static unsigned int tx_pthresh = i82540EM_SETTING_TX_PTHRESH;
+module_param(tx_pthresh, uint, 0444);
+MODULE_PARM_DESC(tx_pthresh, "TXDCTL prefetch threshold in descriptors, 0-63");
+
+static unsigned int tx_hthresh = i82540EM_SETTING_TX_HTHRESH;
+module_param(tx_hthresh, uint, 0444);
+MODULE_PARM_DESC(tx_hthresh, "TXDCTL host threshold in descriptors, 0-63");
+
+static unsigned int tx_wthresh = i82540EM_SETTING_TX_WTHRESH;
+module_param(tx_wthresh, uint, 0444);
+MODULE_PARM_DESC(tx_wthresh, "TXDCTL write-back threshold in descriptors, 0-63");
+
+static unsigned int rdmts = i82540EM_SETTING_RDMTS;
+module_param(rdmts, uint, 0444);
+MODULE_PARM_DESC(rdmts, "RX descriptor minimum threshold: 0 = 1/2, 1 = 1/4, 2 = 1/8 of the ring");
+
+// Self-test burst, adjustable at runtime like copybreak.
+static unsigned int selftest_frames = i82540EM_SETTING_SELFTEST_FRAMES;
+module_param(selftest_frames, uint, 0644);
+MODULE_PARM_DESC(selftest_frames, "Number of frames sent by the ethtool -t loopback test, 1 to 16384");
+
+static unsigned int selftest_frame_size = i82540EM_SETTING_SELFTEST_FRAME_SIZE;
+module_param(selftest_frame_size, uint, 0644);
+MODULE_PARM_DESC(selftest_frame_size, "Size of the frames sent by the ethtool -t loopback test, 60 to 1514");
+
+// Read a register of the internal PHY through MDIC.
+static int i82540EM_read_phy(struct i82540EM *i82540EM_dev, u32 reg, u16 *value){
+
+	unsigned int waited;
+	u32 mdic;
+
+	writel(reg << i82540EM_MDIC_SHIFT_REGADD | i82540EM_PHY_ADDRESS << i82540EM_MDIC_SHIFT_PHYADD | i82540EM_MDIC_OP_READ,
+	       i82540EM_dev->regs + i82540EM_MDIC);
+
+	for(waited = 0; waited < i82540EM_MDIC_TIMEOUT_US; waited += 50){
+		mdic = readl(i82540EM_dev->regs + i82540EM_MDIC);
+		if(mdic & i82540EM_MDIC_BITMASK_R){
+			if(mdic & i82540EM_MDIC_BITMASK_E)
+				return -EIO;
+			*value = mdic & i82540EM_MDIC_BITMASK_DATA;
+			return 0;
+		}
+		udelay(50);
+	}
+
+	return -ETIMEDOUT;
+}
+
+// Write a register of the internal PHY through MDIC.
+static int i82540EM_write_phy(struct i82540EM *i82540EM_dev, u32 reg, u16 value){
+
+	unsigned int waited;
+	u32 mdic;
+
+	writel(value | reg << i82540EM_MDIC_SHIFT_REGADD | i82540EM_PHY_ADDRESS << i82540EM_MDIC_SHIFT_PHYADD | i82540EM_MDIC_OP_WRITE,
+	       i82540EM_dev->regs + i82540EM_MDIC);
+
+	for(waited = 0; waited < i82540EM_MDIC_TIMEOUT_US; waited += 50){
+		mdic = readl(i82540EM_dev->regs + i82540EM_MDIC);
+		if(mdic & i82540EM_MDIC_BITMASK_R)
+			return mdic & i82540EM_MDIC_BITMASK_E ? -EIO : 0;
+		udelay(50);
+	}
+
+	return -ETIMEDOUT;
+}
+
+// Self-test payload byte. Depends on the sequence number so misordered or stale frames are caught.
+static u8 i82540EM_selftest_byte(u32 seq, unsigned int offset){
+	return (u8)(seq * 7 + offset);
+}
+
+// Build self-test frame number seq, addressed to ourselves.
+static void i82540EM_selftest_fill(struct i82540EM *i82540EM_dev, u8 *frame, unsigned int length, u32 seq){
+
+	unsigned int i;
+
+	memcpy(frame, i82540EM_dev->net_dev->dev_addr, ETH_ALEN);
+	memcpy(frame + ETH_ALEN, i82540EM_dev->net_dev->dev_addr, ETH_ALEN);
+	frame[12] = i82540EM_SETTING_SELFTEST_ETHER_TYPE >> 8;
+	frame[13] = i82540EM_SETTING_SELFTEST_ETHER_TYPE & 0xFF;
+	memcpy(frame + ETH_HLEN, &seq, sizeof(seq));
+
+	for(i = ETH_HLEN + sizeof(seq); i < length; i++)
+		frame[i] = i82540EM_selftest_byte(seq, i);
+}
+
+// Called by rx_data() for each complete frame while the self-test runs.
+// Each frame is checked against the sequence number it carries, so a lost or
+// misordered frame counts as one error instead of shifting every later frame.
+// RCTL.SECRC is clear, so the device leaves the FCS on the end of the frame.
+static void i82540EM_selftest_receive(struct i82540EM *i82540EM_dev, struct sk_buff *skb){
+
+	unsigned int frame_size = i82540EM_dev->selftest_frame_size;
+	u8 chunk[64];
+	unsigned int offset, i;
+	u32 seq;
+	int ok;
+
+	// Anything but a self-test frame is stray traffic, drop it uncounted.
+	if(skb->len < ETH_HLEN + sizeof(seq) || skb_copy_bits(skb, 0, chunk, ETH_HLEN + sizeof(seq)) ||
+	   memcmp(chunk + ETH_ALEN, i82540EM_dev->net_dev->dev_addr, ETH_ALEN) ||
+	   chunk[12] != i82540EM_SETTING_SELFTEST_ETHER_TYPE >> 8 || chunk[13] != (i82540EM_SETTING_SELFTEST_ETHER_TYPE & 0xFF)){
+		kfree_skb(skb);
+		return;
+	}
+	memcpy(&seq, chunk + ETH_HLEN, sizeof(seq));
+
+	ok = seq == i82540EM_dev->selftest_next_seq && (skb->len == frame_size + ETH_FCS_LEN || skb->len == frame_size);
+	i82540EM_dev->selftest_next_seq = seq + 1;
+
+	// The frame may be split over fragments, compare it a chunk at a time.
+	for(offset = 0; ok && offset < frame_size; offset += sizeof(chunk)){
+
+		unsigned int length = min_t(unsigned int, sizeof(chunk), frame_size - offset);
+
+		if(skb_copy_bits(skb, offset, chunk, length)){
+			ok = 0;
+			break;
+		}
+
+		if(!offset){
+			ok = !memcmp(chunk, i82540EM_dev->net_dev->dev_addr, ETH_ALEN);
+			i = ETH_HLEN + sizeof(seq);
+		}else{
+			i = 0;
+		}
+
+		for(; ok && i < length; i++)
+			ok = chunk[i] == i82540EM_selftest_byte(seq, offset + i);
+	}
+
+	if(!ok)
+		i82540EM_dev->selftest_errors++;
+	i82540EM_dev->selftest_received++;
+
+	kfree_skb(skb);
+}
+
+// Tasklet function to pass received frames up the stack.
 // Serialized across CPUs.
 void rx_data(unsigned long int param){
 
@@ -62,32 +333,78 @@ void rx_data(unsigned long int param){
 	// Process all done descriptors up to head.
 	while((tail + 1) % i82540EM_SETTING_RX_BUFFER_COUNT != head && i82540EM_dev->rx_descriptors[(tail + 1) % i82540EM_SETTING_RX_BUFFER_COUNT].status){
 
+		// On interrupt, tail points to last processed descriptor.
+		// Look at the next valid descriptor, tail only moves once it's consumed.
+		u32 next = (tail + 1) % i82540EM_SETTING_RX_BUFFER_COUNT;
+		struct i82540EM_rx_descriptor *rx_descriptor = &i82540EM_dev->rx_descriptors[next];
+		struct i82540EM_rx_buffer *rx_buffer = &i82540EM_dev->rx_buffers[next];
+		struct i82540EM_rx_buffer replacement = {0};
+		unsigned int length = rx_descriptor->length;
+		unsigned int copy_length = 0;
+		u8 *data;
+
+		// Make the device's writes visible before looking at the frame.
+		dma_sync_single_range_for_cpu(&i82540EM_dev->pci_dev->dev, rx_buffer->dma, i82540EM_rx_map_offset(i82540EM_dev, rx_buffer), i82540EM_dev->rx_buffer_size, DMA_FROM_DEVICE);
+		data = page_address(rx_buffer->page) + rx_buffer->page_offset;
+
+		// Frames under copybreak that fit one descriptor are copied whole, and the buffer is re-armed in place.
+		// Otherwise only the headers of the first descriptor are copied and the rest is attached as a page fragment.
+		if(!i82540EM_dev->rx_skb_buffer){
+			if(length < READ_ONCE(copybreak) && rx_descriptor->status & i82540EM_RX_STATUS_BITMASK_EOP)
+				copy_length = length;
+			else
+				copy_length = eth_get_headlen(i82540EM_dev->net_dev, data, min_t(unsigned int, length, i82540EM_SETTING_RX_HEADER_SIZE));
+		}
+
+		// Part of the buffer goes up the stack. Unless the descriptor can flip to the other half
+		// of its page, it needs a fresh buffer. If that fails, leave the descriptor for the next run.
+		if(copy_length < length && !i82540EM_can_flip_rx_buffer(i82540EM_dev, rx_buffer)){
+			if(i82540EM_alloc_rx_buffer(i82540EM_dev, &replacement)){
+				uart_print("rx_data(): Failed to allocate receive page\n");
+				return;
+			}
+		}
+
 		// Allocate new packet buffer if needed. If it fails, don't process descriptors.
-		if (!i82540EM_dev->rx_skb_buffer){
+		if(!i82540EM_dev->rx_skb_buffer){
 
-			i82540EM_dev->rx_skb_buffer = dev_alloc_skb(i82540EM_SETTING_ETHERNET_MTU);
+			i82540EM_dev->rx_skb_buffer = netdev_alloc_skb_ip_align(i82540EM_dev->net_dev, copy_length);
 			if(!i82540EM_dev->rx_skb_buffer){
+				if(replacement.page)
+					i82540EM_free_rx_buffer(i82540EM_dev, &replacement);
 				uart_print("rx_data(): Failed to allocate packet buffer\n");
 				return;
 			}
 		}
 
-		// On interrupt, tail points to last processed descriptor.
-		// Increment to point to the next valid descriptor.
-		tail++;
-		tail %= i82540EM_SETTING_RX_BUFFER_COUNT;
+		tail = next;
 
-		//uart_print("\n");
-		//buffer_uart_print(i82540EM_dev->rx_buffers + tail * i82540EM_SETTING_RX_BUFFER_SIZE, i82540EM_dev->rx_descriptors[tail].length, 16);
-		//uart_print("\n");
+		// Copy small frames and headers to the packet buffer.
+		if(copy_length)
+			memcpy(skb_put(i82540EM_dev->rx_skb_buffer, copy_length), data, copy_length);
+
+		// Pass the rest zero-copy.
+		if(copy_length < length){
+
+			skb_add_rx_frag(i82540EM_dev->rx_skb_buffer, skb_shinfo(i82540EM_dev->rx_skb_buffer)->nr_frags,
+					rx_buffer->page, rx_buffer->page_offset + copy_length, length - copy_length,
+					i82540EM_dev->rx_buffer_size);
+
+			if(replacement.page){
+				// The fragment took our page reference, only the mapping is left to undo.
+				dma_unmap_page_attrs(&i82540EM_dev->pci_dev->dev, rx_buffer->dma, i82540EM_rx_map_size(i82540EM_dev), DMA_FROM_DEVICE, DMA_ATTR_SKIP_CPU_SYNC);
+				*rx_buffer = replacement;
+			}else{
+				// Keep a reference for ourselves and flip to the other half.
+				page_ref_inc(rx_buffer->page);
+				rx_buffer->page_offset ^= i82540EM_dev->rx_buffer_size;
+			}
+		}
 
-		// Copy data to packet buffer.
-		memcpy(skb_put(i82540EM_dev->rx_skb_buffer, i82540EM_dev->rx_descriptors[tail].length),
-			       i82540EM_dev->rx_buffers + tail * i82540EM_SETTING_RX_BUFFER_SIZE,
-			       i82540EM_dev->rx_descriptors[tail].length);
+		i82540EM_arm_rx_buffer(i82540EM_dev, tail);
 
 		// If end of packet, send it up the stack.
-		if(i82540EM_dev->rx_descriptors[tail].status & i82540EM_RX_STATUS_BITMASK_EOP){
+		if(rx_descriptor->status & i82540EM_RX_STATUS_BITMASK_EOP){
 
 			// Dump complete packet. Debug.
 			uart_print("rx_data(): Dumping RX data.\n");
@@ -96,16 +413,24 @@ void rx_data(unsigned long int param){
 			uart_print("rx_data(): rx_skb_buffer->data address: %llx\n", 			i82540EM_dev->rx_skb_buffer->data);
 			uart_print("rx_data(): rx_skb_buffer->data physical address: %llx\n", 		virt_to_phys(i82540EM_dev->rx_skb_buffer->data));
 			uart_print("rx_data(): RX packet bytes:\n");
-			buffer_uart_print(i82540EM_dev->rx_skb_buffer->data, i82540EM_dev->rx_skb_buffer->len, 16);
+			buffer_uart_print(i82540EM_dev->rx_skb_buffer->data, skb_headlen(i82540EM_dev->rx_skb_buffer), 16);
 			uart_print("\n");
 
-			// Set metadata
-			i82540EM_dev->rx_skb_buffer->ip_summed = CHECKSUM_UNNECESSARY;
-			i82540EM_dev->rx_skb_buffer->dev = i82540EM_dev->net_dev;
-			i82540EM_dev->rx_skb_buffer->protocol = eth_type_trans(i82540EM_dev->rx_skb_buffer, i82540EM_dev->net_dev);
+			if(unlikely(i82540EM_dev->selftest_running)){
 
-			// Send packet up the networking stack.
-			netif_rx(i82540EM_dev->rx_skb_buffer);
+				// Loopback self-test frame, verify and drop it.
+				i82540EM_selftest_receive(i82540EM_dev, i82540EM_dev->rx_skb_buffer);
+
+			}else{
+
+				// Set metadata
+				i82540EM_dev->rx_skb_buffer->ip_summed = CHECKSUM_UNNECESSARY;
+				i82540EM_dev->rx_skb_buffer->dev = i82540EM_dev->net_dev;
+				i82540EM_dev->rx_skb_buffer->protocol = eth_type_trans(i82540EM_dev->rx_skb_buffer, i82540EM_dev->net_dev);
+
+				// Send packet up the networking stack.
+				netif_rx(i82540EM_dev->rx_skb_buffer);
+			}
 
 			// Remove our reference to the packet buffer, the kernel will free it.
 			// Will be reallocated on next iteration.
@@ -114,7 +439,7 @@ void rx_data(unsigned long int param){
 		}
 
 		// Mark packet as handled.
-		i82540EM_dev->rx_descriptors[tail].status = 0;
+		rx_descriptor->status = 0;
 
 		// Tail is already incremented for the next loop. Update the hw ring.
 		// Barrier to ensure this happens only after status has been cleared.
@@ -127,12 +452,28 @@ void rx_data(unsigned long int param){
 
 static void i82540EM_unmap_dma_mappings(struct i82540EM *i82540EM_dev){
 
+	unsigned int i = 0;
+
+	// Drop a partially received frame, it may hold fragments of our pages.
+	if(i82540EM_dev->rx_skb_buffer){
+		kfree_skb(i82540EM_dev->rx_skb_buffer);
+		i82540EM_dev->rx_skb_buffer = 0;
+	}
+
 	if(i82540EM_dev->rx_descriptors)
 		dma_free_coherent(&i82540EM_dev->pci_dev->dev, i82540EM_SETTING_RX_BUFFER_COUNT * i82540EM_RX_DESCRIPTOR_SIZE, i82540EM_dev->rx_descriptors, i82540EM_dev->rx_descriptors_dma_handle);
 	if(i82540EM_dev->tx_descriptors)
 		dma_free_coherent(&i82540EM_dev->pci_dev->dev, i82540EM_SETTING_TX_BUFFER_COUNT * i82540EM_TX_DESCRIPTOR_SIZE, i82540EM_dev->tx_descriptors, i82540EM_dev->tx_descriptors_dma_handle);
-	if(i82540EM_dev->rx_buffers)
-		dma_free_coherent(&i82540EM_dev->pci_dev->dev, i82540EM_SETTING_RX_BUFFER_COUNT * i82540EM_SETTING_RX_BUFFER_SIZE, i82540EM_dev->rx_buffers, i82540EM_dev->rx_buffers_dma_handle);
+	if(i82540EM_dev->rx_buffers){
+		for(i = 0; i < i82540EM_SETTING_RX_BUFFER_COUNT; i++)
+			if(i82540EM_dev->rx_buffers[i].page)
+				i82540EM_free_rx_buffer(i82540EM_dev, &i82540EM_dev->rx_buffers[i]);
+		kfree(i82540EM_dev->rx_buffers);
+	}
+	if(i82540EM_dev->rx_refill_page){
+		put_page(i82540EM_dev->rx_refill_page);
+		i82540EM_dev->rx_refill_page = 0;
+	}
 	if(i82540EM_dev->tx_buffers)
 		dma_free_coherent(&i82540EM_dev->pci_dev->dev, i82540EM_SETTING_TX_BUFFER_COUNT * i82540EM_SETTING_TX_BUFFER_SIZE, i82540EM_dev->tx_buffers, i82540EM_dev->tx_buffers_dma_handle);
 
@@ -144,10 +485,13 @@ static void i82540EM_unmap_dma_mappings(struct i82540EM *i82540EM_dev){
 
 static int i82540EM_init_dma_mappings(struct i82540EM *i82540EM_dev){
 
+	unsigned int i = 0;
+
 	// Allocate DMA mapping for the tx/rx descriptor rings and buffers.
+	// Coherent memory comes from the device's node already.
 	i82540EM_dev->rx_descriptors 	= dma_alloc_coherent(&i82540EM_dev->pci_dev->dev, i82540EM_SETTING_RX_BUFFER_COUNT * i82540EM_RX_DESCRIPTOR_SIZE, &i82540EM_dev->rx_descriptors_dma_handle, GFP_KERNEL);
 	i82540EM_dev->tx_descriptors 	= dma_alloc_coherent(&i82540EM_dev->pci_dev->dev, i82540EM_SETTING_TX_BUFFER_COUNT * i82540EM_TX_DESCRIPTOR_SIZE, &i82540EM_dev->tx_descriptors_dma_handle, GFP_KERNEL);
-	i82540EM_dev->rx_buffers 	= dma_alloc_coherent(&i82540EM_dev->pci_dev->dev, i82540EM_SETTING_RX_BUFFER_COUNT * i82540EM_SETTING_RX_BUFFER_SIZE, &i82540EM_dev->rx_buffers_dma_handle, GFP_KERNEL);
+	i82540EM_dev->rx_buffers 	= kcalloc_node(i82540EM_SETTING_RX_BUFFER_COUNT, sizeof(*i82540EM_dev->rx_buffers), GFP_KERNEL, i82540EM_dev->numa_node);
 	i82540EM_dev->tx_buffers 	= dma_alloc_coherent(&i82540EM_dev->pci_dev->dev, i82540EM_SETTING_TX_BUFFER_COUNT * i82540EM_SETTING_TX_BUFFER_SIZE, &i82540EM_dev->tx_buffers_dma_handle, GFP_KERNEL);
 
 	// Debug
@@ -162,10 +506,67 @@ static int i82540EM_init_dma_mappings(struct i82540EM *i82540EM_dev){
 		return -ENOMEM;
 	}
 
+	// Receive buffers are streaming-mapped pages, so they can be passed up the stack.
+	for(i = 0; i < i82540EM_SETTING_RX_BUFFER_COUNT; i++){
+		if(i82540EM_alloc_rx_buffer(i82540EM_dev, &i82540EM_dev->rx_buffers[i])){
+			i82540EM_unmap_dma_mappings(i82540EM_dev);
+			dev_err(&i82540EM_dev->pci_dev->dev, "Failed to allocate receive pages. Exiting.\n");
+			return -ENOMEM;
+		}
+	}
+
 	// Returns zero on success.
 	return 0;
 }
 
+// Clamp a descriptor threshold parameter to what the register field holds.
+static u32 i82540EM_dctl_threshold(struct i82540EM *i82540EM_dev, const char *name, unsigned int value, unsigned int fallback){
+
+	if(value > i82540EM_DCTL_THRESH_MAX){
+		dev_warn(&i82540EM_dev->pci_dev->dev, "%s %u out of range, using %u.\n", name, value, fallback);
+		return fallback;
+	}
+
+	return value;
+}
+
+// Program RXDCTL/TXDCTL from the module parameters.
+// Thresholds are in descriptors (GRAN set) rather than cache lines.
+static void i82540EM_init_descriptor_control(struct i82540EM *i82540EM_dev){
+
+	u32 rx_w = i82540EM_dctl_threshold(i82540EM_dev, "rx_wthresh", rx_wthresh, i82540EM_SETTING_RX_WTHRESH);
+
+	writel(	i82540EM_DCTL_BITMASK_GRAN |
+		i82540EM_dctl_threshold(i82540EM_dev, "rx_pthresh", rx_pthresh, i82540EM_SETTING_RX_PTHRESH) << i82540EM_DCTL_SHIFT_PTHRESH |
+		i82540EM_dctl_threshold(i82540EM_dev, "rx_hthresh", rx_hthresh, i82540EM_SETTING_RX_HTHRESH) << i82540EM_DCTL_SHIFT_HTHRESH |
+		rx_w << i82540EM_DCTL_SHIFT_WTHRESH,
+		i82540EM_dev->regs + i82540EM_RXDCTL);
+
+	writel(	i82540EM_DCTL_BITMASK_GRAN |
+		i82540EM_dctl_threshold(i82540EM_dev, "tx_pthresh", tx_pthresh, i82540EM_SETTING_TX_PTHRESH) << i82540EM_DCTL_SHIFT_PTHRESH |
+		i82540EM_dctl_threshold(i82540EM_dev, "tx_hthresh", tx_hthresh, i82540EM_SETTING_TX_HTHRESH) << i82540EM_DCTL_SHIFT_HTHRESH |
+		i82540EM_dctl_threshold(i82540EM_dev, "tx_wthresh", tx_wthresh, i82540EM_SETTING_TX_WTHRESH) << i82540EM_DCTL_SHIFT_WTHRESH,
+		i82540EM_dev->regs + i82540EM_TXDCTL);
+
+	// With RDTR at zero every descriptor is written back on its own and WTHRESH is ignored.
+	// The timers bound how long a partial batch, and its interrupt, can wait.
+	if(rx_w > 1){
+		writel(i82540EM_SETTING_RX_DELAY, i82540EM_dev->regs + i82540EM_RDTR);
+		writel(i82540EM_SETTING_RX_DELAY, i82540EM_dev->regs + i82540EM_RADV);
+	}
+}
+
+// RCTL.RDMTS bits for the rdmts module parameter.
+static u32 i82540EM_rctl_rdmts(struct i82540EM *i82540EM_dev){
+
+	if(rdmts > i82540EM_RDMTS_MAX){
+		dev_warn(&i82540EM_dev->pci_dev->dev, "rdmts %u out of range, using %u.\n", rdmts, i82540EM_SETTING_RDMTS);
+		return i82540EM_SETTING_RDMTS << i82540EM_RCTL_SHIFT_RDMTS;
+	}
+
+	return rdmts << i82540EM_RCTL_SHIFT_RDMTS;
+}
+
 static int i82540EM_probe(struct pci_dev *pci_dev, const struct pci_device_id *ent){
 
 	/*
@@ -229,6 +630,7 @@ static int i82540EM_probe(struct pci_dev *pci_dev, const struct pci_device_id *e
 
 	// Pass the net device it's operation struct.
  	net_dev->netdev_ops = &i82540EM_net_ops;
+	net_dev->ethtool_ops = &i82540EM_ethtool_ops;
 
 	spin_lock_init(&i82540EM_dev->lock);
 
@@ -279,6 +681,26 @@ static int i82540EM_probe(struct pci_dev *pci_dev, const struct pci_device_id *e
 	for(i = 0; i < i82540EM_MTA_SIZE; i++)
 		writel(0, i82540EM_dev->regs + i82540EM_MTA + (4 * i));
 
+	// Node the device sits on. Buffers, and the CPUs handling its interrupt, are kept there.
+	i82540EM_dev->numa_node = dev_to_node(&pci_dev->dev);
+
+	// Receive buffer size, must be known before the buffers are allocated.
+	i82540EM_dev->rx_buffer_size = rx_buffer_size;
+	if(rx_buffer_size != 256 && rx_buffer_size != 512 && rx_buffer_size != 1024 && rx_buffer_size != 2048){
+		dev_warn(&pci_dev->dev, "rx_buffer_size %u not supported, using %u.\n", rx_buffer_size, i82540EM_SETTING_RX_BUFFER_SIZE);
+		i82540EM_dev->rx_buffer_size = i82540EM_SETTING_RX_BUFFER_SIZE;
+	}
+
+	// The device takes 64-bit buffer addresses. Without a wider mask, receive pages
+	// above 4 GB would bounce through swiotlb on every frame.
+	error = dma_set_mask_and_coherent(&pci_dev->dev, DMA_BIT_MASK(64));
+	if(error)
+		error = dma_set_mask_and_coherent(&pci_dev->dev, DMA_BIT_MASK(32));
+	if(error){
+		dev_err(&pci_dev->dev, "i82540EM: probe(): No usable DMA mask, exiting.\n");
+		goto err_init_dma_mappings;
+	}
+
 	// Request the DMA mappings for the RX/TX descriptors and buffers.
 	error = i82540EM_init_dma_mappings(i82540EM_dev);
 	if(error){
@@ -289,7 +711,7 @@ static int i82540EM_probe(struct pci_dev *pci_dev, const struct pci_device_id *e
 	// Initialize the RX/TX descriptors.
 	// Set status to zero, and provide the buffer address in a platform-independant way.
 	for (i = 0; i < i82540EM_SETTING_RX_BUFFER_COUNT; i++){
-		*(void**)(i82540EM_dev->rx_descriptors + i) = (void*)(i82540EM_dev->rx_buffers_dma_handle + i * i82540EM_SETTING_RX_BUFFER_SIZE);
+		i82540EM_arm_rx_buffer(i82540EM_dev, i);
 		i82540EM_dev->rx_descriptors[i].status = 0;
 	}
 	for (i = 0; i < i82540EM_SETTING_TX_BUFFER_COUNT; i++){
@@ -319,6 +741,9 @@ static int i82540EM_probe(struct pci_dev *pci_dev, const struct pci_device_id *e
 	writel(0, i82540EM_dev->regs + i82540EM_TDT);
 	writel(0, i82540EM_dev->regs + i82540EM_TDH);
 
+	// Descriptor prefetch and write-back thresholds.
+	i82540EM_init_descriptor_control(i82540EM_dev);
+
 	// Initialize the transmitter.
 	// 0x40 << 12 COLD setting as per doc.
 	writel(i82540EM_TCTL_BITMASK_EN | 0x40 << 12, i82540EM_dev->regs + i82540EM_TCTL);
@@ -328,7 +753,9 @@ static int i82540EM_probe(struct pci_dev *pci_dev, const struct pci_device_id *e
 	writel(	i82540EM_RCTL_BITMASK_EN  |
 		i82540EM_RCTL_BITMASK_BAM |
 		i82540EM_RCTL_BITMASK_UPE |
-		i82540EM_RCTL_BITMASK_MPE,
+		i82540EM_RCTL_BITMASK_MPE |
+		i82540EM_rctl_bsize(i82540EM_dev) |
+		i82540EM_rctl_rdmts(i82540EM_dev),
 		i82540EM_dev->regs + i82540EM_RCTL);
 
 	// Initialize the RX Tasklet. Must be done before interrupts are enabled.
@@ -355,6 +782,11 @@ static int i82540EM_probe(struct pci_dev *pci_dev, const struct pci_device_id *e
 	}
 	i82540EM_dev->irq_accquired = 1;
 
+	// Steer the interrupt, and with it the RX tasklet, to CPUs on the device's node.
+	// irqbalance honours the hint as well.
+	if(i82540EM_dev->numa_node != NUMA_NO_NODE)
+		irq_set_affinity_hint(pci_dev->irq, cpumask_of_node(i82540EM_dev->numa_node));
+
 	// REGISTER THE DEVICE.
 	error = register_netdev(net_dev);
 	if(error){
@@ -369,6 +801,7 @@ static int i82540EM_probe(struct pci_dev *pci_dev, const struct pci_device_id *e
 
 err_netdev_register:
 	if(i82540EM_dev->irq_accquired){
+		irq_set_affinity_hint(pci_dev->irq, 0);
 		free_irq(pci_dev->irq, i82540EM_dev);
 		i82540EM_dev->irq_accquired = 0;
 	}
@@ -410,8 +843,10 @@ static void i82540EM_remove(struct pci_dev *pci_dev){
 		// Unregister first to stop all activity.
 		unregister_netdev(net_dev);
 
-		if(i82540EM_dev->irq_accquired)
+		if(i82540EM_dev->irq_accquired){
+			irq_set_affinity_hint(pci_dev->irq, 0);
 			free_irq(pci_dev->irq, i82540EM_dev);
+		}
 
 		if(i82540EM_dev->regs){
 			iounmap(i82540EM_dev->regs);
@@ -464,11 +899,15 @@ static netdev_tx_t tx_data(struct sk_buff *tx_skb_buffer, struct net_device *dev
 		return NETDEV_TX_BUSY;
 	}
 
-	//u32 head = readl(i82540EM_dev->regs + i82540EM_TDH);
 	tail = readl(i82540EM_dev->regs + i82540EM_TDT);
 
 	// Check if we have a free descriptor at tail to write to.
-	if(!(i82540EM_dev->tx_descriptors[tail].status & i82540EM_TX_STATUS_BITMASK_DD)){
+	// One descriptor always stays unused: advancing tail onto head would
+	// make the hardware see an empty ring and drop everything queued.
+	// Tail + 1 can only be head while that descriptor is queued and not yet
+	// written back, so its DD bit tells us without reading TDH.
+	if(!(i82540EM_dev->tx_descriptors[tail].status & i82540EM_TX_STATUS_BITMASK_DD) ||
+	   !(i82540EM_dev->tx_descriptors[(tail + 1) % i82540EM_SETTING_TX_BUFFER_COUNT].status & i82540EM_TX_STATUS_BITMASK_DD)){
 		uart_print("tx_data(): No free descriptor. Dropping.\n");
 		return NETDEV_TX_BUSY;
 	}
@@ -480,7 +919,8 @@ static netdev_tx_t tx_data(struct sk_buff *tx_skb_buffer, struct net_device *dev
 
 	// Set the command bit to report status and end of packet.
 	// We're assuming single-descriptor packets sincke descriptor size > MTU of 1500.
-	i82540EM_dev->tx_descriptors[tail].command = i82540EM_TX_COMMAND_BITMASK_EOP | i82540EM_TX_COMMAND_BITMASK_RS;
+	// The device appends the FCS, the stack doesn't.
+	i82540EM_dev->tx_descriptors[tail].command = i82540EM_TX_COMMAND_BITMASK_EOP | i82540EM_TX_COMMAND_BITMASK_IFCS | i82540EM_TX_COMMAND_BITMASK_RS;
 
 	// Copy the skb buffer data.
 	memcpy(i82540EM_dev->tx_buffers + tail * i82540EM_SETTING_TX_BUFFER_SIZE, tx_skb_buffer->data, tx_skb_buffer->len);
@@ -501,6 +941,200 @@ static netdev_tx_t tx_data(struct sk_buff *tx_skb_buffer, struct net_device *dev
 
 }
 
+// rx_data() is a tasklet function. Called from the ethtool ioctl it must run
+// with bottom halves off, like a tasklet, or netif_rx() leaves NET_RX pending.
+static void i82540EM_selftest_poll(struct i82540EM *i82540EM_dev){
+
+	local_bh_disable();
+	rx_data((unsigned long int)i82540EM_dev);
+	local_bh_enable();
+}
+
+static const char i82540EM_selftest_strings[][ETH_GSTRING_LEN] = {
+	"Loopback test  (offline)",
+	"Loopback frames received",
+	"Loopback frames per second",
+	"Loopback cycles per frame",
+};
+
+#define i82540EM_SELFTEST_COUNT ARRAY_SIZE(i82540EM_selftest_strings)
+
+// Push a burst of frames through tx_data() with the PHY in loopback and
+// receive them through rx_data(). Interrupts are masked and the RX tasklet
+// disabled, rx_data() is polled from here instead.
+// PHY loopback rather than RCTL.LBM: it is what e1000 uses on copper parts,
+// and the only loopback QEMU's e1000 model implements.
+// Returns zero if every frame came back intact.
+static int i82540EM_loopback_test(struct i82540EM *i82540EM_dev, u64 *data){
+
+	struct net_device *net_dev = i82540EM_dev->net_dev;
+	unsigned int frames = READ_ONCE(selftest_frames);
+	unsigned int length = READ_ONCE(selftest_frame_size);
+	unsigned long timeout = jiffies + msecs_to_jiffies(i82540EM_SETTING_SELFTEST_TIMEOUT_MS);
+	unsigned int descriptors_per_frame = DIV_ROUND_UP(length + ETH_FCS_LEN, i82540EM_dev->rx_buffer_size);
+	u32 ctrl, ims;
+	u16 phy_ctrl;
+	u64 start_ns, elapsed_ns = 0;
+	cycles_t start_cycles, elapsed_cycles = 0;
+	struct sk_buff *skb;
+	unsigned int sent = 0;
+	int error = 0;
+
+	if(!frames || frames > i82540EM_SETTING_SELFTEST_FRAMES_MAX || length < ETH_ZLEN || length > ETH_FRAME_LEN)
+		return -EINVAL;
+
+	// Quiesce: no transmits from the stack, no interrupts, no tasklet.
+	if(netif_running(net_dev))
+		netif_tx_disable(net_dev);
+	ims = readl(i82540EM_dev->regs + i82540EM_IMS);
+	writel(0xFFFFFFFF, i82540EM_dev->regs + i82540EM_IMC);
+	tasklet_disable(&i82540EM_dev->rx_tasklet);
+
+	// Anything already in the ring belongs to the stack.
+	i82540EM_selftest_poll(i82540EM_dev);
+
+	i82540EM_dev->selftest_received = 0;
+	i82540EM_dev->selftest_errors = 0;
+	i82540EM_dev->selftest_next_seq = 0;
+	i82540EM_dev->selftest_frame_size = length;
+
+	// Frames the stack queued before the queue stopped must leave before
+	// loopback is on, or they come back as part of the test.
+	while(readl(i82540EM_dev->regs + i82540EM_TDH) != readl(i82540EM_dev->regs + i82540EM_TDT)){
+		if(time_after(jiffies, timeout)){
+			dev_err(&i82540EM_dev->pci_dev->dev, "Self-test: transmit ring did not drain.\n");
+			error = -ETIMEDOUT;
+			goto restore_interrupts;
+		}
+		cpu_relax();
+	}
+
+	// PHY loopback at a forced 1000 Mb/s full duplex, the MAC forced to match.
+	// Loss of signal is inverted, as the looped back PHY reports no link.
+	ctrl = readl(i82540EM_dev->regs + i82540EM_CTRL);
+	error = i82540EM_read_phy(i82540EM_dev, i82540EM_PHY_CTRL, &phy_ctrl);
+	if(!error)
+		error = i82540EM_write_phy(i82540EM_dev, i82540EM_PHY_CTRL,
+					   i82540EM_PHY_CTRL_BITMASK_LOOPBACK | i82540EM_PHY_CTRL_BITMASK_SPEED_MSB | i82540EM_PHY_CTRL_BITMASK_FD);
+	if(error){
+		dev_err(&i82540EM_dev->pci_dev->dev, "Self-test: PHY access failed.\n");
+		goto restore_interrupts;
+	}
+	writel((ctrl & ~i82540EM_CTRL_BITMASK_SPEED) |
+	       i82540EM_CTRL_BITMASK_FRCSPD | i82540EM_CTRL_BITMASK_FRCDPLX | i82540EM_CTRL_SPEED_1000 |
+	       i82540EM_CTRL_BITMASK_FD | i82540EM_CTRL_BITMASK_SLU | i82540EM_CTRL_BITMASK_ILOS,
+	       i82540EM_dev->regs + i82540EM_CTRL);
+	udelay(500);
+
+	i82540EM_dev->selftest_running = 1;
+
+	start_ns = ktime_get_ns();
+	start_cycles = get_cycles();
+
+	while(sent < frames && !error){
+
+		skb = netdev_alloc_skb(net_dev, length);
+		if(!skb){
+			error = -ENOMEM;
+			break;
+		}
+		i82540EM_selftest_fill(i82540EM_dev, skb_put(skb, length), length, sent);
+
+		// TX ring full, give the device time to drain it.
+		while(tx_data(skb, net_dev) != NETDEV_TX_OK){
+			i82540EM_selftest_poll(i82540EM_dev);
+			if(time_after(jiffies, timeout)){
+				kfree_skb(skb);
+				error = -ETIMEDOUT;
+				break;
+			}
+			cpu_relax();
+		}
+		if(error)
+			break;
+
+		sent++;
+
+		// Keep the RX ring from overflowing. With small buffers a frame takes several descriptors.
+		if((sent - i82540EM_dev->selftest_received) * descriptors_per_frame >= i82540EM_SETTING_RX_BUFFER_COUNT / 2)
+			i82540EM_selftest_poll(i82540EM_dev);
+	}
+
+	// Wait for the rest of the burst to loop back.
+	while(!error && i82540EM_dev->selftest_received < sent){
+		i82540EM_selftest_poll(i82540EM_dev);
+		if(time_after(jiffies, timeout))
+			error = -ETIMEDOUT;
+		cpu_relax();
+	}
+
+	elapsed_cycles = get_cycles() - start_cycles;
+	elapsed_ns = ktime_get_ns() - start_ns;
+
+	// Restore normal operation. Auto-negotiation restarts if it was on.
+	i82540EM_dev->selftest_running = 0;
+	if(phy_ctrl & i82540EM_PHY_CTRL_BITMASK_AN_EN)
+		phy_ctrl |= i82540EM_PHY_CTRL_BITMASK_RESTART_AN;
+	i82540EM_write_phy(i82540EM_dev, i82540EM_PHY_CTRL, phy_ctrl);
+	writel(ctrl, i82540EM_dev->regs + i82540EM_CTRL);
+
+restore_interrupts:
+	tasklet_enable(&i82540EM_dev->rx_tasklet);
+	readl(i82540EM_dev->regs + i82540EM_ICR);
+	writel(ims, i82540EM_dev->regs + i82540EM_IMS);
+	if(netif_running(net_dev))
+		netif_wake_queue(net_dev);
+
+	data[1] = i82540EM_dev->selftest_received;
+	data[2] = elapsed_ns ? div64_u64((u64)i82540EM_dev->selftest_received * NSEC_PER_SEC, elapsed_ns) : 0;
+	data[3] = i82540EM_dev->selftest_received ? div64_u64(elapsed_cycles, i82540EM_dev->selftest_received) : 0;
+
+	uart_print("i82540EM_loopback_test(): sent %u received %u errors %u in %llu ns\n",
+		   sent, i82540EM_dev->selftest_received, i82540EM_dev->selftest_errors, elapsed_ns);
+
+	if(!error && (i82540EM_dev->selftest_errors || i82540EM_dev->selftest_received != frames))
+		error = -EIO;
+
+	return error;
+}
+
+static void i82540EM_self_test(struct net_device *net_dev, struct ethtool_test *eth_test, u64 *data){
+
+	struct i82540EM *i82540EM_dev = netdev_priv(net_dev);
+
+	memset(data, 0, i82540EM_SELFTEST_COUNT * sizeof(*data));
+
+	// Loopback takes the link away from the stack, only run it offline.
+	if(!(eth_test->flags & ETH_TEST_FL_OFFLINE))
+		return;
+
+	data[0] = i82540EM_loopback_test(i82540EM_dev, data) ? 1 : 0;
+	if(data[0])
+		eth_test->flags |= ETH_TEST_FL_FAILED;
+}
+
+static int i82540EM_get_sset_count(struct net_device *net_dev, int sset){
+
+	switch(sset){
+	case ETH_SS_TEST:
+		return i82540EM_SELFTEST_COUNT;
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static void i82540EM_get_strings(struct net_device *net_dev, u32 stringset, u8 *data){
+
+	if(stringset == ETH_SS_TEST)
+		memcpy(data, i82540EM_selftest_strings, sizeof(i82540EM_selftest_strings));
+}
+
+static const struct ethtool_ops i82540EM_ethtool_ops = {
+	.self_test		= i82540EM_self_test,
+	.get_sset_count		= i82540EM_get_sset_count,
+	.get_strings		= i82540EM_get_strings,
+};
+
 static const struct net_device_ops i82540EM_net_ops = {
 	//.ndo_open	= i82540EM_open,
 	//.ndo_stop	= i82540EM_close,
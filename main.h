@@ -16,6 +16,7 @@ static const char ETHERNET_ADDRESS[] = {0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
 #define i82540EM_CTRL_BITMASK_SLU 		0x40	   	// Set Link Up
 #define i82540EM_CTRL_BITMASK_ILOS 		0x80       	// Invert Loss-Of-Signal
 #define i82540EM_CTRL_BITMASK_SPEED 		0x300  	   	// Speed
+#define i82540EM_CTRL_SPEED_1000 		0x200  	   	// Speed: 1000 Mb/s.
 #define i82540EM_CTRL_BITMASK_FRCSPD 		0x800 	   	// Force set speed.
 #define i82540EM_CTRL_BITMASK_FRCDPLX 		0x1000     	// Force duplex
 #define i82540EM_CTRL_BITMASK_SDP0_DATA 	0x40000    	// SDP0
@@ -30,6 +31,24 @@ static const char ETHERNET_ADDRESS[] = {0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
 #define i82540EM_CTRL_BITMASK_VME		0x40000000 	// Vlan Mode Enable
 #define i82540EM_CTRL_BITMASK_PHY_RST		0x80000000 	// PHY Reset
 
+#define i82540EM_MDIC				0x20		// MDI Control Register.
+#define i82540EM_MDIC_BITMASK_DATA		0xFFFF		// PHY register data.
+#define i82540EM_MDIC_SHIFT_REGADD		16		// PHY register address.
+#define i82540EM_MDIC_SHIFT_PHYADD		21		// PHY address.
+#define i82540EM_MDIC_OP_WRITE			0x4000000	// Opcode: MDI write.
+#define i82540EM_MDIC_OP_READ			0x8000000	// Opcode: MDI read.
+#define i82540EM_MDIC_BITMASK_R			0x10000000	// Ready, set when the transaction completes.
+#define i82540EM_MDIC_BITMASK_E			0x40000000	// Error.
+#define i82540EM_MDIC_TIMEOUT_US		2000		// Transaction timeout.
+
+#define i82540EM_PHY_ADDRESS			1		// The internal PHY sits at MDIO address 1.
+#define i82540EM_PHY_CTRL			0x0		// PHY Control Register (MII BMCR).
+#define i82540EM_PHY_CTRL_BITMASK_SPEED_MSB	0x40		// Speed select MSB, 1000 Mb/s with LSB clear.
+#define i82540EM_PHY_CTRL_BITMASK_FD		0x100		// Full duplex.
+#define i82540EM_PHY_CTRL_BITMASK_RESTART_AN	0x200		// Restart auto-negotiation.
+#define i82540EM_PHY_CTRL_BITMASK_AN_EN		0x1000		// Auto-negotiation enable.
+#define i82540EM_PHY_CTRL_BITMASK_LOOPBACK	0x4000		// Loopback.
+
 #define i82540EM_RCTL 				0x100 		// Receive Control Register Base.
 #define i82540EM_RCTL_BITMASK_EN 		0x2		// Receiver Enable.
 #define i82540EM_RCTL_BITMASK_SBP 		0x4		// Store Bad Packets.
@@ -41,6 +60,10 @@ static const char ETHERNET_ADDRESS[] = {0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
 #define i82540EM_RCTL_BITMASK_MO 		0x3000		// Multicast Offset.
 #define i82540EM_RCTL_BITMASK_BAM 		0x8000		// Broadcast Accept Mode.
 #define i82540EM_RCTL_BITMASK_BSIZE 		0x30000		// Receive Buffer Size.
+#define i82540EM_RCTL_BSIZE_2048 		0x0		// Receive Buffer Size: 2048 bytes (BSEX clear).
+#define i82540EM_RCTL_BSIZE_1024 		0x10000		// Receive Buffer Size: 1024 bytes (BSEX clear).
+#define i82540EM_RCTL_BSIZE_512 		0x20000		// Receive Buffer Size: 512 bytes (BSEX clear).
+#define i82540EM_RCTL_BSIZE_256 		0x30000		// Receive Buffer Size: 256 bytes (BSEX clear).
 #define i82540EM_RCTL_BITMASK_VFE 		0x40000 	// VLAN Filter Enable.
 #define i82540EM_RCTL_BITMASK_CFIEN 		0x80000		// Canonical Form Indicator Enable.
 #define i82540EM_RCTL_BITMASK_CFI 		0x100000	// Canonical Form Inidcator Bit Value
@@ -94,12 +117,29 @@ static const char ETHERNET_ADDRESS[] = {0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
 #define i82540EM_RDLEN 				0x2808		// Receive Descriptor Length in bytes
 #define i82540EM_RDH 				0x2810		// Recieve Descriptor Head
 #define i82540EM_RDT 				0x2818		// Receive Descriptor Tail
+#define i82540EM_RDTR 				0x2820		// Receive Delay Timer
+#define i82540EM_RXDCTL 			0x2828		// Receive Descriptor Control
+#define i82540EM_RADV 				0x282C		// Receive Interrupt Absolute Delay Timer
 
 #define i82540EM_TDBAL				0x3800	 	// Transmit Descriptor Base Address Low
 #define i82540EM_TDBAH				0x3804		// Transmit Descriptor Base Address High
 #define i82540EM_TDLEN				0x3808		// Transmit Descriptor Length in bytes
 #define i82540EM_TDH				0x3810		// Transmit Descriptor Head
 #define i82540EM_TDT				0x3818		// Transmit Descriptor Tail
+#define i82540EM_TXDCTL				0x3828		// Transmit Descriptor Control
+
+// Shared layout of RXDCTL and TXDCTL.
+#define i82540EM_DCTL_BITMASK_PTHRESH		0x3F		// Prefetch Threshold
+#define i82540EM_DCTL_SHIFT_PTHRESH		0
+#define i82540EM_DCTL_BITMASK_HTHRESH		0x3F00		// Host Threshold
+#define i82540EM_DCTL_SHIFT_HTHRESH		8
+#define i82540EM_DCTL_BITMASK_WTHRESH		0x3F0000	// Write-Back Threshold
+#define i82540EM_DCTL_SHIFT_WTHRESH		16
+#define i82540EM_DCTL_BITMASK_GRAN		0x1000000	// Thresholds in descriptors, not cache lines
+#define i82540EM_DCTL_THRESH_MAX		63
+
+#define i82540EM_RCTL_SHIFT_RDMTS		8
+#define i82540EM_RDMTS_MAX			2		// 0 = 1/2, 1 = 1/4, 2 = 1/8 of the ring.
 
 #define i82540EM_RX_STATUS_BITMASK_DD		0x1	 	// Descriptor Done
 #define i82540EM_RX_STATUS_BITMASK_EOP 		0x2		// End-of-Packet
@@ -133,14 +173,53 @@ static const char ETHERNET_ADDRESS[] = {0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
 #define i82540EM_SETTING_TX_BUFFER_COUNT 256
 
 // Default size in RCTL, > MTU.
+// Each RX buffer is half a page, see struct i82540EM_rx_buffer.
+// Smaller sizes (rx_buffer_size parameter) split full-size frames over several descriptors.
 #define i82540EM_SETTING_RX_BUFFER_SIZE  2048
 
+// Default copybreak. Frames shorter than this are copied, longer ones are passed up zero-copy.
+#define i82540EM_SETTING_RX_COPYBREAK 256
+
+// Bytes of a zero-copy frame copied into the skb linear area so the stack can parse headers.
+#define i82540EM_SETTING_RX_HEADER_SIZE 256
+
 // TSO is disabled, we expcet < MUT sized frames from the networking stack.
 #define i82540EM_SETTING_TX_BUFFER_SIZE 2048
 
 // Defult size of skb to prevent resizing, accepts jumbo frames.
 #define i82540EM_SETTING_ETHERNET_MTU 1550
 
+// Descriptor fetch and write-back thresholds, in descriptors.
+// Prefetch in bursts once the on-chip cache runs low, write RX descriptors back
+// four at a time. Same burst values e1000e uses on parts that support it.
+#define i82540EM_SETTING_RX_PTHRESH 32
+#define i82540EM_SETTING_RX_HTHRESH 4
+#define i82540EM_SETTING_RX_WTHRESH 4
+#define i82540EM_SETTING_TX_PTHRESH 31
+#define i82540EM_SETTING_TX_HTHRESH 0
+#define i82540EM_SETTING_TX_WTHRESH 1
+
+// RX write-back batching only happens while the receive delay timers run.
+// Used when RX WTHRESH > 1, in 1.024 usec units.
+#define i82540EM_SETTING_RX_DELAY 32
+
+// RXDMT0 fires when free RX descriptors drop to 1/2 of the ring.
+#define i82540EM_SETTING_RDMTS 0
+
+// Default burst for the ethtool -t PHY loopback self-test.
+#define i82540EM_SETTING_SELFTEST_FRAMES 1024
+#define i82540EM_SETTING_SELFTEST_FRAME_SIZE 1024
+
+// Self-test frames use the IEEE local experimental ethertype.
+#define i82540EM_SETTING_SELFTEST_ETHER_TYPE 0x88B5
+
+// Time allowed for the whole burst to loop back.
+#define i82540EM_SETTING_SELFTEST_TIMEOUT_MS 2000
+
+// Largest burst. The test busy-polls under RTNL, so the burst has to fit the
+// timeout: 16384 frames in 2 s still passes at a loopback rate of 8192 frames/s.
+#define i82540EM_SETTING_SELFTEST_FRAMES_MAX 16384
+
 // Legacy-type descriptor.
 struct i82540EM_tx_descriptor{
 
@@ -166,6 +245,20 @@ struct i82540EM_rx_descriptor{
 	u16 special;
 };
 
+// Receive buffer backing one RX descriptor.
+// With 2048 byte buffers the page holds two buffers. When one half is passed
+// up the stack as a fragment, the descriptor flips to the other half if the
+// stack already released it, otherwise a fresh page is mapped.
+// Smaller buffers are carved out of a page shared by several descriptors,
+// each holding its own page reference and a mapping of just its slot, and
+// are replaced once passed up.
+struct i82540EM_rx_buffer{
+
+	struct page *page;
+	dma_addr_t dma;
+	unsigned int page_offset;
+};
+
 struct i82540EM{
 
 	// Spin lock protecting the oject.
@@ -181,13 +274,20 @@ struct i82540EM{
 	// Memory-mapped registers.
 	void *regs;
 
+	// NUMA node of the device, NUMA_NO_NODE if unknown.
+	int numa_node;
+
 	// Pointer to receive descriptor ring
 	struct i82540EM_rx_descriptor *rx_descriptors;
 	dma_addr_t rx_descriptors_dma_handle;
 
-	// Receive buffers.
-	char *rx_buffers;
-	dma_addr_t rx_buffers_dma_handle;
+	// Receive buffers, one per receive descriptor.
+	struct i82540EM_rx_buffer *rx_buffers;
+	unsigned int rx_buffer_size;
+
+	// Partly carved page the next small receive buffer comes from.
+	struct page *rx_refill_page;
+	unsigned int rx_refill_offset;
 
 	// Pointer to transmit descriptor ring.
 	struct i82540EM_tx_descriptor *tx_descriptors;
@@ -205,6 +305,16 @@ struct i82540EM{
 
 	// In-progress packet buffer
 	struct sk_buff *rx_skb_buffer;
+
+	// PHY loopback self-test. While running, rx_data() hands
+	// frames to the self-test instead of the networking stack.
+	// The frame size is latched at the start of a run, the
+	// module parameter may change underneath it.
+	char selftest_running;
+	unsigned int selftest_received;
+	unsigned int selftest_errors;
+	u32 selftest_next_seq;
+	unsigned int selftest_frame_size;
 //	struct sk_buff *tx_skb_buffer;
 
 